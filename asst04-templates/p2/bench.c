@@ -0,0 +1,93 @@
+#include "workerpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Benchmark for the worker pool. Build with:
+ *   gcc -O2 -o bench bench.c workerpool.c -lpthread
+ */
+
+#define ROUNDS 2000
+
+/*
+ * Pause between two submissions, so that every job finds the workers idle.
+ */
+#define GAP_US 20
+
+static uint64_t _latencies[ROUNDS];
+static volatile int _completed;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Records the time between submission and the start of the job.
+ */
+static void latency_job(void *context, void *payload)
+{
+    uint64_t start = now_ns();
+    int round = (int)(intptr_t)context;
+    _latencies[round] = start - *(uint64_t*)payload;
+    __atomic_store_n(&_completed, round + 1, __ATOMIC_RELEASE);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void run_rounds(const char *name)
+{
+    _completed = 0;
+    for (int i = 0; i < ROUNDS; ++i) {
+        uint64_t submitted = now_ns();
+        while (submitWorkCtx(latency_job, (void*)(intptr_t)i,
+                             &submitted, sizeof(submitted)) != 0);
+        while (__atomic_load_n(&_completed, __ATOMIC_ACQUIRE) != i + 1);
+        usleep(GAP_US);
+    }
+
+    qsort(_latencies, ROUNDS, sizeof(uint64_t), compare_u64);
+    printf("%-24s p50 %8lu ns  p90 %8lu ns  p99 %8lu ns  max %8lu ns\n", name,
+           (unsigned long)_latencies[ROUNDS / 2],
+           (unsigned long)_latencies[ROUNDS * 90 / 100],
+           (unsigned long)_latencies[ROUNDS * 99 / 100],
+           (unsigned long)_latencies[ROUNDS - 1]);
+}
+
+int main()
+{
+    printf("Wake up latency over %d rounds, %d us between jobs\n", ROUNDS, GAP_US);
+
+    if (initializeWorkerPool() != 0) {
+        return 1;
+    }
+    run_rounds("classic (condvar)");
+    finalizeWorkerPool();
+
+    WorkerPoolConfig park = {.minWorkers = 4, .maxWorkers = 4};
+    if (initializeWorkerPoolEx(&park) != 0) {
+        return 1;
+    }
+    run_rounds("adaptive, park only");
+    finalizeWorkerPool();
+
+    WorkerPoolConfig spin = {
+        .minWorkers = 1, .maxWorkers = 8, .spinIterations = 20000, .idleTimeoutMs = 100
+    };
+    if (initializeWorkerPoolEx(&spin) != 0) {
+        return 1;
+    }
+    run_rounds("adaptive, spin+park");
+    finalizeWorkerPool();
+
+    return 0;
+}
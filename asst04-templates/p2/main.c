@@ -1,8 +1,11 @@
+#define _GNU_SOURCE
 #include "testlib.h"
 #include "workerpool.h"
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 static void short_job(int arg)
@@ -17,6 +20,52 @@ static void long_job(int arg)
     printf("Worker <%i>: Executed long job with arg %i.\n", getWorkerId(), arg);
 }
 
+typedef struct _Request {
+    int id;
+    char name[16];
+} Request;
+
+static volatile int _ctxJobsDone = 0;
+static volatile int _payloadsFreed = 0;
+
+static void ctx_job(void *context, void *payload)
+{
+    Request *request = (Request*)payload;
+    printf("Worker <%i>: Executed context job %s with request %i (%s).\n",
+           getWorkerId(), (char*)context, request->id, request->name);
+    __sync_fetch_and_add(&_ctxJobsDone, 1);
+}
+
+static void free_request(void *payload)
+{
+    free(payload);
+    __sync_fetch_and_add(&_payloadsFreed, 1);
+}
+
+static volatile int _placedCpu = -1;
+static volatile int _placedNode = -1;
+
+static void placed_job(int arg)
+{
+    (void)arg;
+    _placedCpu = sched_getcpu();
+    _placedNode = getWorkerNode();
+}
+
+static char _order[16];
+static volatile int _orderLen = 0;
+
+static void ordered_job(int arg)
+{
+    _order[_orderLen++] = (char)arg;
+}
+
+static void blocking_job(int arg)
+{
+    (void)arg;
+    usleep(300000);
+}
+
 int main()
 {
     test_start("workerpool.c");
@@ -46,9 +95,127 @@ int main()
     r = submitWork(long_job, 6);
     test_equals_int(r, 0, "submitWork succeeds");
 
+    // Context jobs carry their payload in the work item.
+    Request request = {7, "inline"};
+    r = submitWorkCtx(ctx_job, "A", &request, sizeof(request));
+    test_equals_int(r, 0, "submitWorkCtx succeeds");
+
+    r = submitWorkCtx(ctx_job, "B", &request, WORK_INLINE_PAYLOAD + 1);
+    test_equals_int(r, -1, "submitWorkCtx fails with oversized payload");
+
+    Request *owned = malloc(sizeof(Request));
+    *owned = (Request) {8, "owned"};
+    r = submitWorkOwned(ctx_job, "C", owned, free_request);
+    test_equals_int(r, 0, "submitWorkOwned succeeds");
+
     // Give the worker pool some time to process the work items before we exit.
     sleep(1);
 
+    test_equals_int(_ctxJobsDone, 2, "context jobs executed");
+    test_equals_int(_payloadsFreed, 1, "owned payload released");
+    test_equals_int(getWorkerPoolStats(NULL, NULL, 0), 0,
+        "pool without collectStats reports no slots");
+
+    finalizeWorkerPool();
+
+    // In adaptive mode the pool grows while jobs queue up and shrinks back to
+    // the minimum once the workers idle.
+    WorkerPoolConfig config = {
+        .minWorkers = 1, .maxWorkers = 4, .spinIterations = 1000
+    };
+    r = initializeWorkerPoolEx(&config);
+    test_equals_int(r, -1, "initializeWorkerPoolEx fails without idle timeout");
+
+    config.idleTimeoutMs = 100;
+    r = initializeWorkerPoolEx(&config);
+    test_equals_int(r, 0, "initializeWorkerPoolEx succeeds");
+    test_equals_int(getNumWorkers(), 1, "adaptive pool starts with minWorkers");
+
+    for (int i = 10; i < 14; i++) {
+        r = submitWork(long_job, i);
+        test_equals_int(r, 0, "submitWork succeeds");
+    }
+    test_assert(getNumWorkers() > 1, "adaptive pool grows under load");
+
+    sleep(2);
+    test_equals_int(getNumWorkers(), 1, "adaptive pool shrinks when idle");
+
+    finalizeWorkerPool();
+
+    // Pinned workers with NUMA queues run node-hinted jobs on their node.
+    int cpus[] = {0};
+    WorkerPoolConfig pinned = {
+        .minWorkers = 2, .maxWorkers = 2, .cpus = cpus, .numCpus = 1,
+        .pinWorkers = 1, .numaQueues = 1
+    };
+    r = initializeWorkerPoolEx(&pinned);
+    test_equals_int(r, 0, "initializeWorkerPoolEx with pinning succeeds");
+
+    WorkOptions options = WORK_OPTIONS_DEFAULT;
+    test_equals_int(options.node, WORK_ANY_NODE, "default options do not pin jobs to a node");
+    options.node = 0;
+    r = submitWorkEx(&options, placed_job, 0);
+    test_equals_int(r, 0, "submitWorkEx succeeds");
+    sleep(1);
+    test_equals_int(_placedCpu, 0, "pinned worker runs on its CPU");
+    test_equals_int(_placedNode, 0, "job runs on the hinted node");
+
+    finalizeWorkerPool();
+
+    // A single worker runs queued jobs by priority and lets starving lanes
+    // through after starvationLimit jobs.
+    WorkerPoolConfig single = {
+        .minWorkers = 1, .maxWorkers = 1, .starvationLimit = 2, .collectStats = 1
+    };
+    r = initializeWorkerPoolEx(&single);
+    test_equals_int(r, 0, "initializeWorkerPoolEx with one worker succeeds");
+
+    WorkOptions low = WORK_OPTIONS_DEFAULT, high = WORK_OPTIONS_DEFAULT, invalid = WORK_OPTIONS_DEFAULT;
+    low.priority = WORK_PRIORITY_LOW;
+    high.priority = WORK_PRIORITY_HIGH;
+    invalid.priority = 5;
+    r = submitWorkEx(&invalid, ordered_job, 'X');
+    test_equals_int(r, -1, "submitWorkEx fails with invalid priority");
+
+    submitWorkEx(&high, blocking_job, 0);
+    usleep(100000);
+    submitWorkEx(&low, ordered_job, 'L');
+    submitWork(ordered_job, 'N');
+    submitWorkEx(&high, ordered_job, 'H');
+    sleep(1);
+    _order[_orderLen] = '\0';
+    test_equals_string(_order, "HNL", "jobs run in priority order");
+
+    _orderLen = 0;
+    submitWorkEx(&high, blocking_job, 0);
+    usleep(100000);
+    submitWorkEx(&low, ordered_job, 'L');
+    for (int i = 0; i < 4; i++) {
+        submitWorkEx(&high, ordered_job, 'H');
+    }
+    sleep(1);
+    _order[_orderLen] = '\0';
+    test_equals_string(_order, "HHLHH", "starving lane gets its turn");
+
+    // Both rounds above ran 4 + 6 jobs on the single worker, and at most
+    // five of them were queued at once.
+    WorkerPoolStats stats;
+    WorkerStats workerStats;
+    uint32_t slots = getWorkerPoolStats(&stats, &workerStats, 1);
+    test_equals_int(slots, 1, "getWorkerPoolStats reports one slot");
+    test_equals_int64(stats.total.jobsRun, 10, "stats count executed jobs");
+    test_equals_int64(workerStats.jobsRun, 10, "worker stats count executed jobs");
+    test_equals_int(stats.queueDepth, 0, "queue is empty");
+    test_equals_int(stats.maxQueueDepth, 5, "stats track maximum queue depth");
+    test_assert(workerStats.busyNs >= 600000000, "stats account busy time");
+    test_assert(workerStats.parks > 0, "stats count parks");
+
+    uint64_t delays = 0;
+    for (int i = 0; i < WORK_STATS_BUCKETS; i++) {
+        delays += workerStats.queueDelay[i];
+    }
+    test_equals_int64(delays, 10, "queue delay histogram counts every job");
+
     finalizeWorkerPool();
     return test_end();
 }
@@ -1,11 +1,18 @@
+#define _GNU_SOURCE
 #include "workerpool.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <inttypes.h>
 #include <assert.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 /*
  * Indicates if the worker threads should exit. If done is 0 the workers
@@ -17,13 +24,91 @@ static volatile int _done = 1;
 /*
  * Ringbuffer to hold jobs for the workers
  */
-WorkItem _workItems[MAX_JOBS];
-uint32_t _nextJob = 0;
-uint32_t _numJobs = 0;
+typedef struct _WorkRing {
+    WorkItem items[MAX_JOBS];
+    uint32_t nextJob;
+    uint32_t numJobs;
+} WorkRing;
+
+/*
+ * Job queue with one ringbuffer per priority lane. Lane 0 holds the most
+ * urgent jobs. With NUMA queues there is one job queue per node, otherwise
+ * only the first one is used.
+ */
+typedef struct _WorkQueue {
+    WorkRing lanes[WORK_PRIORITY_LANES];
+} __attribute__((aligned(64))) WorkQueue;
+
+static WorkQueue _queues[MAX_NODES];
+static uint32_t _numQueues = 1;
+
+/*
+ * Total number of jobs over all queues, and per lane over all queues.
+ */
+static uint32_t _numJobs = 0;
+static uint32_t _laneJobs[WORK_PRIORITY_LANES];
+
+/*
+ * Number of times each lane was passed over while it held jobs.
+ */
+static uint32_t _laneSkips[WORK_PRIORITY_LANES];
+
+/*
+ * Maximum of _numJobs since initialization.
+ */
+static uint32_t _maxQueueDepth = 0;
+
+/*
+ * NUMA node of each CPU as reported by sysfs. All CPUs belong to node 0 if
+ * the pool does not use NUMA queues.
+ */
+static uint8_t _cpuNode[CPU_SETSIZE];
+
+/*
+ * State of an entry in the workers array. Workers that retired in adaptive
+ * mode still have to be joined before their slot can be reused.
+ */
+typedef enum _WorkerState {
+    WORKER_UNUSED = 0,
+    WORKER_RUNNING,
+    WORKER_EXITED
+} WorkerState;
 
 static pthread_t* workers = NULL;
+static WorkerState* _workerStates = NULL;
 static uint32_t _numWorkers = 0;
-// ---> TODO: Add variables as neeed <---
+
+/*
+ * CPUs the workers are placed on. Worker slot i is assigned to CPU
+ * _cpus[i % _numCpus] and serves the queue of that CPU's node.
+ */
+static int* _cpus = NULL;
+static uint32_t _numCpus = 0;
+
+/*
+ * Counters of each worker slot. Each slot gets its own cache line, so the
+ * workers do not contend when updating them.
+ */
+typedef struct _PaddedWorkerStats {
+    WorkerStats stats;
+} __attribute__((aligned(64))) PaddedWorkerStats;
+
+static PaddedWorkerStats* _workerStats = NULL;
+
+/*
+ * Configuration of the pool. In adaptive mode idle workers spin and park on
+ * _wakeSeq instead of waiting on the condition variable.
+ */
+static WorkerPoolConfig _config;
+static int _adaptive = 0;
+
+/*
+ * Futex word of parked workers. Submitters increment it after enqueuing work
+ * so that a worker that is about to park does not miss the wake up.
+ */
+static volatile uint32_t _wakeSeq = 0;
+static uint32_t _numParked = 0;
+static uint32_t _numIdle = 0;
 
 /*
  * The id of the current thread. The id is initialized by the workers main
@@ -33,6 +118,17 @@ static uint32_t _numWorkers = 0;
  */
 static __thread int _workerId;
 
+/*
+ * The NUMA node of the current worker, which selects its home queue.
+ */
+static __thread int _workerNode;
+
+/*
+ * The counters of the current worker or NULL if the pool does not collect
+ * statistics. Only the owning worker writes them.
+ */
+static __thread WorkerStats *_stats;
+
 /*
  * Condition variable for synchronization of worker threads. Synchronization
  * will be covered in the lecture at a later point.
@@ -53,44 +149,271 @@ static pthread_cond_t _cv;
 #define Broadcast(cv) \
     pthread_cond_broadcast(&(cv))
 
+#if defined(__x86_64__) || defined(__i386__)
+#define CpuRelax() \
+    __asm__ __volatile__ ("pause" ::: "memory")
+#else
+#define CpuRelax() \
+    Barrier()
+#endif
+
+/*
+ * Updates a counter that only the current thread writes, but others may read
+ * concurrently.
+ */
+#define StatAdd(counter, value) \
+    __atomic_store_n(&(counter), (counter) + (value), __ATOMIC_RELAXED)
+
+/*
+ * Upper bound for the exponential backoff between two polls of the queue.
+ */
+#define MAX_BACKOFF 64
+
+/*
+ * Returns the current time in ns.
+ */
+static uint64_t _nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Blocks on the futex word as long as it holds the value val or until the
+ * timeout (in milliseconds, 0 for none) expires.
+ * Returns -1 if the timeout expired, 0 otherwise.
+ */
+static int _futexWait(volatile uint32_t *word, uint32_t val, uint32_t timeoutMs)
+{
+    struct timespec timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000000L};
+    long r = syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val,
+                     (timeoutMs > 0) ? &timeout : NULL, NULL, 0);
+    return ((r == -1) && (errno == ETIMEDOUT)) ? -1 : 0;
+}
+
+/*
+ * Wakes up to count threads blocked on the futex word.
+ */
+static void _futexWake(volatile uint32_t *word, int count)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/*
+ * Selects the queue for a job with the given node hint. Jobs without a valid
+ * hint go to the queue of the submitting thread's node.
+ */
+static uint32_t _submitQueue(int node)
+{
+    if (_numQueues == 1) {
+        return 0;
+    }
+    if ((node >= 0) && ((uint32_t)node < _numQueues)) {
+        return node;
+    }
+    if (_workerId >= 0) {
+        return _workerNode;
+    }
+    int cpu = sched_getcpu();
+    return ((cpu >= 0) && (cpu < CPU_SETSIZE)) ? _cpuNode[cpu] : 0;
+}
+
+/*
+ * Selects the queue and lane for a job with the given options.
+ * Returns -1 if the options are invalid, 0 otherwise.
+ */
+static int _submitTarget(const WorkOptions *options, uint32_t *queue,
+                         uint32_t *lane)
+{
+    if (options == NULL) {
+        *queue = _submitQueue(WORK_ANY_NODE);
+        *lane = WORK_PRIORITY_HIGH - WORK_PRIORITY_NORMAL;
+        return 0;
+    }
+    if ((options->priority < WORK_PRIORITY_LOW) ||
+        (options->priority > WORK_PRIORITY_HIGH)) {
+        return -1;
+    }
+    *queue = _submitQueue(options->node);
+    *lane = WORK_PRIORITY_HIGH - options->priority;
+    return 0;
+}
+
+/*
+ * Reserves the next free slot in the ringbuffer of the given queue and lane.
+ * If that ringbuffer is full, the same lane of the other queues is tried. The
+ * caller has to fill in the returned work item while still holding the lock.
+ * Returns NULL if all ringbuffers are full.
+ */
+static WorkItem* _enqueueSlot(uint32_t queue, uint32_t lane)
+{
+    for (uint32_t i = 0; i < _numQueues; ++i) {
+        WorkRing *r = &_queues[(queue + i) % _numQueues].lanes[lane];
+        if (r->numJobs < MAX_JOBS) {
+            uint32_t _in_place = (r->nextJob + r->numJobs) % MAX_JOBS;
+            r->numJobs++;
+            _laneJobs[lane]++;
+            _numJobs++;
+            if (_numJobs > _maxQueueDepth) {
+                _maxQueueDepth = _numJobs;
+            }
+            return &r->items[_in_place];
+        }
+    }
+    return NULL;
+}
+
 /*
  * Append new work to the ringbuffer.
  * Returns -1 on error.
  */
-int _enqueue(WorkFunc func, int arg)
+static int _enqueue(uint32_t queue, uint32_t lane, WorkFunc func, int arg,
+                    uint64_t submitNs)
 {
-    if (_numJobs >= MAX_JOBS) {
+    WorkItem *slot = _enqueueSlot(queue, lane);
+    if (slot == NULL) {
         return -1;
     }
-    uint32_t _in_place = (_nextJob + _numJobs) % MAX_JOBS;
-    _workItems[_in_place] = (WorkItem) {func, arg};
-    _numJobs++;
+    slot->func = func;
+    slot->ctxFunc = NULL;
+    slot->arg = arg;
+    slot->ownedPayload = NULL;
+    slot->payloadSize = 0;
+    slot->submitNs = submitNs;
     return 0;
 }
 
 /*
- * Receives work from the ringbuffer.
+ * Receives work from the given ringbuffer.
  * Returns -1 if no work is available.
  */
-int _dequeue(WorkItem *item)
+static int _dequeueFrom(WorkRing *r, WorkItem *item)
 {
-    if (_numJobs == 0)
+    if (r->numJobs == 0)
     {
         return -1;
     }
-    item->arg = _workItems[_nextJob].arg;
-    item->func = _workItems[_nextJob].func;
-    _workItems[_nextJob] = (WorkItem) {NULL, 0};
-    _nextJob = (_nextJob + 1) % MAX_JOBS;
+    // Only the used part of the inline payload has to be moved out.
+    WorkItem *slot = &r->items[r->nextJob];
+    item->func = slot->func;
+    item->ctxFunc = slot->ctxFunc;
+    item->arg = slot->arg;
+    item->context = slot->context;
+    item->ownedPayload = slot->ownedPayload;
+    item->freePayload = slot->freePayload;
+    item->payloadSize = slot->payloadSize;
+    item->submitNs = slot->submitNs;
+    memcpy(item->inlinePayload, slot->inlinePayload, slot->payloadSize);
+
+    // The work item now owns the payload. Clear the slot so finalization
+    // does not release it a second time.
+    slot->func = NULL;
+    slot->ctxFunc = NULL;
+    slot->ownedPayload = NULL;
+    r->nextJob = (r->nextJob + 1) % MAX_JOBS;
+    r->numJobs--;
     _numJobs--;
     return 0;
 }
 
+/*
+ * Selects the lane to dequeue from. This is the most urgent non-empty lane,
+ * unless a less urgent lane has been passed over starvationLimit times. Must
+ * only be called if there is at least one job.
+ */
+static uint32_t _selectLane(void)
+{
+    uint32_t first = 0;
+    while (_laneJobs[first] == 0) {
+        first++;
+    }
+
+    // Give a starving lane its turn. Lanes further down are checked first,
+    // because they have been passed over by more lanes.
+    for (uint32_t lane = WORK_PRIORITY_LANES - 1; lane > first; --lane) {
+        if ((_laneJobs[lane] > 0) && (_laneSkips[lane] >= _config.starvationLimit)) {
+            _laneSkips[lane] = 0;
+            return lane;
+        }
+    }
+
+    for (uint32_t lane = first + 1; lane < WORK_PRIORITY_LANES; ++lane) {
+        if (_laneJobs[lane] > 0) {
+            _laneSkips[lane]++;
+        }
+    }
+    _laneSkips[first] = 0;
+    return first;
+}
+
+/*
+ * Receives work for the current thread. Within the selected lane, jobs of the
+ * thread's own node are preferred over jobs of other nodes.
+ * Returns -1 if no work is available.
+ */
+static int _dequeue(WorkItem *item)
+{
+    if (_numJobs == 0)
+    {
+        return -1;
+    }
+    // Priority wins over locality: an urgent job of another node runs before
+    // a less urgent local one.
+    uint32_t lane = _selectLane();
+    uint32_t home = (_workerNode > 0) ? (uint32_t)_workerNode : 0;
+    for (uint32_t i = 0; i < _numQueues; ++i) {
+        WorkRing *r = &_queues[(home + i) % _numQueues].lanes[lane];
+        if (_dequeueFrom(r, item) == 0) {
+            _laneJobs[lane]--;
+            if ((i > 0) && (_stats != NULL)) {
+                StatAdd(_stats->steals, 1);
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Releases the payload a work item owns, if any.
+ */
+static void _releasePayload(WorkItem *item)
+{
+    if (item->ownedPayload == NULL) {
+        return;
+    }
+    if (item->freePayload != NULL) {
+        item->freePayload(item->ownedPayload);
+    } else {
+        free(item->ownedPayload);
+    }
+    item->ownedPayload = NULL;
+}
+
+/*
+ * Executes a dequeued work item and releases its payload.
+ */
+static void _runWorkItem(WorkItem *item)
+{
+    if (item->func != NULL) {
+        item->func(item->arg);
+        return;
+    }
+
+    void *payload = item->ownedPayload;
+    if ((payload == NULL) && (item->payloadSize > 0)) {
+        payload = item->inlinePayload;
+    }
+    item->ctxFunc(item->context, payload);
+    _releasePayload(item);
+}
+
 /*
  * Blocks the current thread until there is new work or the thread should exit.
  * Returns 0 if the thread should exit.
  */
-int _waitForWork(WorkItem *item)
+static int _waitForWork(WorkItem *item)
 {
     // We use the condition variable to synchronize access to the work list.
     // We wake up a new thread in submitWork() if new work is available. This
@@ -100,6 +423,9 @@ int _waitForWork(WorkItem *item)
     // go to sleep again with Wait().
     Lock(_cs);
     while ((!_done) && (_dequeue(item) == -1)) {
+        if (_stats != NULL) {
+            StatAdd(_stats->parks, 1);
+        }
         Wait(_cv, _cs);
     }
     Unlock(_cs);
@@ -107,24 +433,159 @@ int _waitForWork(WorkItem *item)
     return !_done;
 }
 
+/*
+ * Adaptive mode counterpart of _waitForWork(). The worker first polls the
+ * queue with an exponential backoff, which keeps the wake up latency of short
+ * bursts low. If no work shows up, it parks on the _wakeSeq futex. Workers
+ * above the minimum retire after idling for the configured timeout.
+ * Returns 0 if the thread should exit.
+ */
+static int _waitForWorkAdaptive(WorkItem *item)
+{
+    __atomic_fetch_add(&_numIdle, 1, __ATOMIC_RELAXED);
+
+    for (;;) {
+        uint32_t backoff = 1;
+        for (uint32_t i = 0; i < _config.spinIterations; i += backoff) {
+            // Peek without the lock. We only take it if there seems to be
+            // something to dequeue.
+            if ((_done) || (__atomic_load_n(&_numJobs, __ATOMIC_RELAXED) > 0)) {
+                break;
+            }
+            for (uint32_t j = 0; j < backoff; ++j) {
+                CpuRelax();
+            }
+            if (backoff < MAX_BACKOFF) {
+                backoff <<= 1;
+            }
+        }
+
+        Lock(_cs);
+        if (_done) {
+            Unlock(_cs);
+            return 0;
+        }
+        if (_dequeue(item) == 0) {
+            Unlock(_cs);
+            __atomic_fetch_sub(&_numIdle, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+
+        // Read the sequence number while holding the lock. Any submitter that
+        // enqueues after we unlock changes it, so the futex wait returns
+        // right away instead of missing the work.
+        uint32_t seq = _wakeSeq;
+        uint32_t timeout = (_numWorkers > _config.minWorkers) ?
+            _config.idleTimeoutMs : 0;
+        _numParked++;
+        Unlock(_cs);
+
+        if (_stats != NULL) {
+            StatAdd(_stats->parks, 1);
+        }
+
+        int timedOut = _futexWait(&_wakeSeq, seq, timeout);
+
+        Lock(_cs);
+        _numParked--;
+        if ((timedOut) && (_numJobs == 0) &&
+            (_numWorkers > _config.minWorkers)) {
+            // Shrink the pool. The slot is joined when it is reused or when
+            // the pool is finalized.
+            _numWorkers--;
+            _workerStates[_workerId] = WORKER_EXITED;
+            Unlock(_cs);
+            __atomic_fetch_sub(&_numIdle, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        Unlock(_cs);
+    }
+}
+
 /*
  * Main routine of the worker threads.
  * Always returns NULL.
  */
-void* _workerMain(void *arg)
+static void* _workerMain(void *arg)
 {
-    // Initialize the thread local worker id variable.
+    // Initialize the thread local worker id, node and counter variables.
     _workerId = (int)((intptr_t)arg);
+    _workerNode = _cpuNode[_cpus[_workerId % _numCpus]];
+    _stats = _config.collectStats ? &_workerStats[_workerId].stats : NULL;
+
     WorkItem item;
-    while (_waitForWork(&item))
+    uint64_t idleSince = (_stats != NULL) ? _nowNs() : 0;
+    while (_adaptive ? _waitForWorkAdaptive(&item) : _waitForWork(&item))
     {
-        item.func(item.arg);
-    }
+        if (_stats == NULL) {
+            _runWorkItem(&item);
+            continue;
+        }
+
+        uint64_t start = _nowNs();
+        _runWorkItem(&item);
+        uint64_t end = _nowNs();
 
+        uint64_t delay = (start > item.submitNs) ? start - item.submitNs : 0;
+        uint32_t bucket = 63 - __builtin_clzll(delay | 1);
+        if (bucket >= WORK_STATS_BUCKETS) {
+            bucket = WORK_STATS_BUCKETS - 1;
+        }
+        StatAdd(_stats->queueDelay[bucket], 1);
+        StatAdd(_stats->jobsRun, 1);
+        StatAdd(_stats->idleNs, start - idleSince);
+        StatAdd(_stats->busyNs, end - start);
+        idleSince = end;
+    }
 
     return NULL; // Will implicitly call pthread_exit() with NULL;
 }
 
+/*
+ * Starts a worker thread in the given slot. A worker that previously retired
+ * from that slot is joined first.
+ * Returns -1 on error, 0 otherwise.
+ */
+static int _startWorker(uint32_t slot, WorkerState previous)
+{
+    if (previous == WORKER_EXITED) {
+        pthread_join(workers[slot], NULL);
+    }
+
+    // Without any placement configured, the kernel may place the worker
+    // anywhere. Otherwise we restrict it to its CPU, its node's CPUs or the
+    // configured CPUs, in that order.
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    int placed = (_config.pinWorkers) || (_config.numaQueues) ||
+                 (_config.numCpus > 0);
+
+    if (placed) {
+        int cpu = _cpus[slot % _numCpus];
+        CPU_ZERO(&cpus);
+        if (_config.pinWorkers) {
+            CPU_SET(cpu, &cpus);
+        } else {
+            for (uint32_t i = 0; i < _numCpus; ++i) {
+                if (_cpuNode[_cpus[i]] == _cpuNode[cpu]) {
+                    CPU_SET(_cpus[i], &cpus);
+                }
+            }
+        }
+        if ((pthread_attr_init(&attr) != 0) ||
+            (pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus) != 0)) {
+            return -1;
+        }
+    }
+
+    int status = pthread_create(workers + slot, placed ? &attr : NULL,
+                                _workerMain, (void *)((intptr_t) slot));
+    if (placed) {
+        pthread_attr_destroy(&attr);
+    }
+    return (status != 0) ? -1 : 0;
+}
+
 /*
  * Starts a specified number of worker threads.
  * Returns -1 on error, 0 otherwise.
@@ -133,36 +594,188 @@ static int _startWorkers(uint32_t num)
 {
     for (uint32_t i = 0; i < num; ++i)
     {
-        int status = pthread_create(workers + i, NULL, _workerMain, (void *)((intptr_t) i));
-        if (status != 0)
+        if (_startWorker(i, WORKER_UNUSED) != 0)
         {
             return -1;
         }
+        _workerStates[i] = WORKER_RUNNING;
+        _numWorkers++;
     }
     return 0;
 }
 
+/*
+ * Starts an additional worker if jobs are queuing up and no idle worker is
+ * left to pick them up. Only used in adaptive mode.
+ */
+static void _growWorkers(void)
+{
+    uint32_t slot = 0;
+    WorkerState previous = WORKER_UNUSED;
+    int grow = 0;
+
+    // Cheap check without the lock first. This is the common case on the
+    // submission path.
+    if ((__atomic_load_n(&_numWorkers, __ATOMIC_RELAXED) >= _config.maxWorkers) ||
+        (__atomic_load_n(&_numJobs, __ATOMIC_RELAXED) <=
+         __atomic_load_n(&_numIdle, __ATOMIC_RELAXED))) {
+        return;
+    }
+
+    Lock(_cs);
+    if ((!_done) && (_numWorkers < _config.maxWorkers) &&
+        (_numJobs > __atomic_load_n(&_numIdle, __ATOMIC_RELAXED))) {
+        while (_workerStates[slot] == WORKER_RUNNING) {
+            slot++;
+        }
+        previous = _workerStates[slot];
+        _workerStates[slot] = WORKER_RUNNING;
+        _numWorkers++;
+        grow = 1;
+    }
+    Unlock(_cs);
+
+    if ((grow) && (_startWorker(slot, previous) != 0)) {
+        Lock(_cs);
+        _workerStates[slot] = WORKER_UNUSED;
+        _numWorkers--;
+        Unlock(_cs);
+    }
+}
+
+/*
+ * Wakes up a single worker for newly submitted work.
+ */
+static void _wakeWorker(void)
+{
+    if (!_adaptive) {
+        Signal(_cv);
+        return;
+    }
+
+    __atomic_fetch_add(&_wakeSeq, 1, __ATOMIC_RELEASE);
+
+    // Spinning workers notice the new work on their own. We only need the
+    // system call if somebody is parked.
+    if (__atomic_load_n(&_numParked, __ATOMIC_RELAXED) > 0) {
+        _futexWake(&_wakeSeq, 1);
+    }
+
+    _growWorkers();
+}
+
 /*
  * Waits for all worker threads to finish. This does not guarantee that all
  * work has been processed!
  */
 static void _waitForWorkers(void)
 {
-    if (workers == NULL) {
+    if ((workers == NULL) || (_workerStates == NULL)) {
         return;
     }
 
-    for (uint32_t i = 0; i < _numWorkers; ++i)
+    uint32_t slots = _adaptive ? _config.maxWorkers : _config.minWorkers;
+    for (uint32_t i = 0; i < slots; ++i)
     {
-        pthread_join(workers[i], NULL);
+        if (_workerStates[i] != WORKER_UNUSED) {
+            pthread_join(workers[i], NULL);
+            _workerStates[i] = WORKER_UNUSED;
+        }
     }
+    _numWorkers = 0;
 }
 
 /*
- * Initializes the worker pool. Must be called before any other routine.
+ * Reads the CPU to node mapping from sysfs into _cpuNode.
+ * Returns the number of nodes, which is 1 if the system does not expose NUMA
+ * information.
+ */
+static uint32_t _discoverNodes(void)
+{
+    uint32_t nodes = 1;
+    char path[64];
+    char list[1024];
+
+    memset(_cpuNode, 0, sizeof(_cpuNode));
+    for (int node = 0; node < MAX_NODES; ++node) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+        if (fgets(list, sizeof(list), f) == NULL) {
+            list[0] = '\0';
+        }
+        fclose(f);
+
+        // The list has the form "0-3,8-11".
+        char *p = list;
+        while ((*p >= '0') && (*p <= '9')) {
+            long first = strtol(p, &p, 10);
+            long last = (*p == '-') ? strtol(p + 1, &p, 10) : first;
+            for (long cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); ++cpu) {
+                _cpuNode[cpu] = node;
+            }
+            if (*p == ',') {
+                p++;
+            }
+        }
+        nodes = node + 1;
+    }
+    return nodes;
+}
+
+/*
+ * Determines the CPUs for the worker slots and the number of job queues.
  * Returns -1 on error, 0 otherwise.
  */
-int initializeWorkerPool(void)
+static int _placeWorkers(const WorkerPoolConfig *config)
+{
+    uint32_t nodes = _discoverNodes();
+    if (!config->numaQueues) {
+        memset(_cpuNode, 0, sizeof(_cpuNode));
+        nodes = 1;
+    }
+    _numQueues = nodes;
+
+    if (config->numCpus > 0) {
+        _cpus = (int *) malloc(sizeof(int) * config->numCpus);
+        if (_cpus == NULL) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < config->numCpus; ++i) {
+            if ((config->cpus[i] < 0) || (config->cpus[i] >= CPU_SETSIZE)) {
+                return -1;
+            }
+            _cpus[i] = config->cpus[i];
+        }
+        _numCpus = config->numCpus;
+        return 0;
+    }
+
+    // Default to all CPUs the process may run on.
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+    _cpus = (int *) malloc(sizeof(int) * CPU_COUNT(&allowed));
+    if (_cpus == NULL) {
+        return -1;
+    }
+    _numCpus = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            _cpus[_numCpus++] = cpu;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Sets up the shared state and starts config->minWorkers workers.
+ * Returns -1 on error, 0 otherwise.
+ */
+static int _initialize(const WorkerPoolConfig *config, int adaptive)
 {
     assert(_done);
 
@@ -170,7 +783,11 @@ int initializeWorkerPool(void)
     // get a valid id.
     _workerId = -1;
 
-    memset(_workItems, 0, sizeof(_workItems));
+    memset(_queues, 0, sizeof(_queues));
+    memset(_laneJobs, 0, sizeof(_laneJobs));
+    memset(_laneSkips, 0, sizeof(_laneSkips));
+    _numJobs = 0;
+    _maxQueueDepth = 0;
     if (pthread_mutex_init(&_cs, NULL) != 0) {
         return -1;
     }
@@ -179,21 +796,26 @@ int initializeWorkerPool(void)
         return -1;
     }
 
-    uint32_t n = 4;
-    // ---> TODO: Initialize n and your variables here <---
-
-    long cores = sysconf(_SC_NPROCESSORS_ONLN);
-
-    if (cores == -1) {
-        return -1;
+    _config = *config;
+    if (_config.starvationLimit == 0) {
+        _config.starvationLimit = WORK_STARVATION_LIMIT;
     }
+    _adaptive = adaptive;
+    _numWorkers = 0;
+    _numParked = 0;
+    _numIdle = 0;
 
-    n = cores > 4 ? cores : 4;
-    _numWorkers = n;
-    workers = (pthread_t *) malloc(sizeof(pthread_t) * n);
-    if (workers == NULL) 
-    {
-        goto error;
+    uint32_t slots = adaptive ? config->maxWorkers : config->minWorkers;
+    workers = (pthread_t *) malloc(sizeof(pthread_t) * slots);
+    _workerStates = (WorkerState *) calloc(slots, sizeof(WorkerState));
+    _workerStats = NULL;
+    if (config->collectStats) {
+        // The size is a multiple of the alignment, which is a power of two.
+        _workerStats = (PaddedWorkerStats *) aligned_alloc(
+            _Alignof(PaddedWorkerStats), sizeof(PaddedWorkerStats) * slots);
+        if (_workerStats != NULL) {
+            memset(_workerStats, 0, sizeof(PaddedWorkerStats) * slots);
+        }
     }
     // Denote the future workers that they should not exit right away, but
     // wait for work. We use a software barrier to prevent the compiler from
@@ -201,8 +823,15 @@ int initializeWorkerPool(void)
     _done = 0;
     Barrier();
 
+    if ((workers == NULL) || (_workerStates == NULL) ||
+        (config->collectStats && (_workerStats == NULL)) ||
+        (_placeWorkers(config) != 0))
+    {
+        goto error;
+    }
+
     // Create the new workers
-    if (_startWorkers(n) != 0) {
+    if (_startWorkers(config->minWorkers) != 0) {
         goto error;
     }
 
@@ -212,6 +841,41 @@ error:
     return -1;
 }
 
+/*
+ * Initializes the worker pool. Must be called before any other routine.
+ * Returns -1 on error, 0 otherwise.
+ */
+int initializeWorkerPool(void)
+{
+    uint32_t n = 4;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cores == -1) {
+        return -1;
+    }
+
+    n = cores > 4 ? cores : 4;
+    WorkerPoolConfig config = {n, n, 0, 0, NULL, 0, 0, 0, 0, 0};
+    return _initialize(&config, 0);
+}
+
+/*
+ * Initializes the worker pool in adaptive mode. Must be called before any
+ * other routine.
+ * Returns -1 on error, 0 otherwise.
+ */
+int initializeWorkerPoolEx(const WorkerPoolConfig *config)
+{
+    if ((config == NULL) || (config->minWorkers == 0) ||
+        (config->maxWorkers < config->minWorkers) ||
+        ((config->maxWorkers > config->minWorkers) &&
+         (config->idleTimeoutMs == 0))) {
+        return -1;
+    }
+
+    return _initialize(config, 1);
+}
+
 /*
  * Finalizes the worker pool. Must be called when the worker pool is not longer
  * needed.
@@ -231,14 +895,31 @@ void finalizeWorkerPool(void)
     // Note that the assignment does not dictate that the worker threads should
     // process all work items before exiting.
     Broadcast(_cv);
+    if (_adaptive) {
+        __atomic_fetch_add(&_wakeSeq, 1, __ATOMIC_RELEASE);
+        _futexWake(&_wakeSeq, INT32_MAX);
+    }
 
     _waitForWorkers();
 
     // All workers should have ended at this point. Clean up.
     pthread_cond_destroy(&_cv);
 
-    // ---> TODO: Free your variables here <---
+    // Jobs that did not run anymore still own their payloads.
+    WorkItem item;
+    while (_dequeue(&item) == 0) {
+        _releasePayload(&item);
+    }
+
     free(workers);
+    free(_workerStates);
+    free(_cpus);
+    free(_workerStats);
+    workers = NULL;
+    _workerStates = NULL;
+    _workerStats = NULL;
+    _cpus = NULL;
+    _numCpus = 0;
 }
 
 /*
@@ -247,26 +928,142 @@ void finalizeWorkerPool(void)
  * Returns -1 on error, 0 otherwise.
  */
 int submitWork(WorkFunc func, int arg)
+{
+    return submitWorkEx(NULL, func, arg);
+}
+
+/*
+ * Same as submitWork() with the given submission options.
+ * Returns -1 on error, 0 otherwise.
+ */
+int submitWorkEx(const WorkOptions *options, WorkFunc func, int arg)
 {
     int r;
+    uint32_t queue, lane;
 
-    if (func == NULL) {
+    if ((func == NULL) || (_submitTarget(options, &queue, &lane) != 0)) {
         return -1;
     }
 
+    uint64_t submitNs = _config.collectStats ? _nowNs() : 0;
+
     // Add the new work to our work list
     Lock(_cs) {
-        r = _enqueue(func, arg);
+        r = _enqueue(queue, lane, func, arg, submitNs);
     } Unlock(_cs);
 
     // Wake up a single worker thread
     if (r == 0) {
-        Signal(_cv);
+        _wakeWorker();
     }
 
     return r;
 }
 
+/*
+ * Adds the given context job with an inline payload to the work list.
+ * Returns -1 on error, 0 otherwise.
+ */
+int submitWorkCtx(WorkCtxFunc func, void *context,
+                  const void *payload, size_t size)
+{
+    return submitWorkCtxEx(NULL, func, context, payload, size);
+}
+
+/*
+ * Same as submitWorkCtx() with the given submission options.
+ * Returns -1 on error, 0 otherwise.
+ */
+int submitWorkCtxEx(const WorkOptions *options, WorkCtxFunc func,
+                    void *context, const void *payload, size_t size)
+{
+    WorkItem *slot;
+    uint32_t queue, lane;
+
+    if ((func == NULL) || (size > WORK_INLINE_PAYLOAD) ||
+        ((payload == NULL) && (size > 0)) ||
+        (_submitTarget(options, &queue, &lane) != 0)) {
+        return -1;
+    }
+
+    uint64_t submitNs = _config.collectStats ? _nowNs() : 0;
+
+    // The payload is copied straight into the ringbuffer, so small jobs do not
+    // need any allocation or side table.
+    Lock(_cs) {
+        slot = _enqueueSlot(queue, lane);
+        if (slot != NULL) {
+            slot->func = NULL;
+            slot->ctxFunc = func;
+            slot->context = context;
+            slot->ownedPayload = NULL;
+            slot->payloadSize = size;
+            slot->submitNs = submitNs;
+            if (size > 0) {
+                memcpy(slot->inlinePayload, payload, size);
+            }
+        }
+    } Unlock(_cs);
+
+    if (slot == NULL) {
+        return -1;
+    }
+
+    _wakeWorker();
+    return 0;
+}
+
+/*
+ * Adds the given context job to the work list and takes over ownership of
+ * its payload.
+ * Returns -1 on error, 0 otherwise.
+ */
+int submitWorkOwned(WorkCtxFunc func, void *context,
+                    void *payload, PayloadFree freePayload)
+{
+    return submitWorkOwnedEx(NULL, func, context, payload, freePayload);
+}
+
+/*
+ * Same as submitWorkOwned() with the given submission options.
+ * Returns -1 on error, 0 otherwise.
+ */
+int submitWorkOwnedEx(const WorkOptions *options, WorkCtxFunc func,
+                      void *context, void *payload, PayloadFree freePayload)
+{
+    WorkItem *slot;
+    uint32_t queue, lane;
+
+    if ((func == NULL) || (payload == NULL) ||
+        (_submitTarget(options, &queue, &lane) != 0)) {
+        return -1;
+    }
+
+    uint64_t submitNs = _config.collectStats ? _nowNs() : 0;
+
+    Lock(_cs) {
+        slot = _enqueueSlot(queue, lane);
+        if (slot != NULL) {
+            slot->func = NULL;
+            slot->ctxFunc = func;
+            slot->context = context;
+            slot->ownedPayload = payload;
+            slot->freePayload = freePayload;
+            slot->payloadSize = 0;
+            slot->submitNs = submitNs;
+        }
+    } Unlock(_cs);
+
+    // If the ringbuffer is full, the payload has not been moved and the
+    // caller is still responsible for it.
+    if (slot == NULL) {
+        return -1;
+    }
+
+    _wakeWorker();
+    return 0;
+}
+
 /*
  * Returns the worker id of the current thread. This should always be -1 for
  * the main thread.
@@ -274,4 +1071,82 @@ int submitWork(WorkFunc func, int arg)
 int getWorkerId(void)
 {
     return _workerId;
-}
\ No newline at end of file
+}
+
+/*
+ * Returns the NUMA node of the current worker thread or -1 for threads that
+ * are not part of the pool.
+ */
+int getWorkerNode(void)
+{
+    return (_workerId >= 0) ? _workerNode : -1;
+}
+
+/*
+ * Returns the number of job queues.
+ */
+uint32_t getNumNodes(void)
+{
+    return _numQueues;
+}
+
+/*
+ * Returns the number of currently running worker threads.
+ */
+uint32_t getNumWorkers(void)
+{
+    return __atomic_load_n(&_numWorkers, __ATOMIC_RELAXED);
+}
+
+/*
+ * Takes a snapshot of the pool counters.
+ * Returns the number of worker slots.
+ */
+uint32_t getWorkerPoolStats(WorkerPoolStats *pool, WorkerStats *perWorker,
+                            uint32_t count)
+{
+    uint32_t slots = _adaptive ? _config.maxWorkers : _config.minWorkers;
+    if (_workerStats == NULL) {
+        slots = 0;
+    }
+
+    if (pool != NULL) {
+        memset(pool, 0, sizeof(*pool));
+        Lock(_cs);
+        pool->numWorkers = _numWorkers;
+        pool->queueDepth = _numJobs;
+        pool->maxQueueDepth = _maxQueueDepth;
+        Unlock(_cs);
+    }
+
+    for (uint32_t i = 0; i < slots; ++i) {
+        // Copy the counters of the slot first. The worker may update them
+        // concurrently, so each counter is read atomically on its own.
+        WorkerStats copy;
+        const WorkerStats *w = &_workerStats[i].stats;
+        copy.jobsRun = __atomic_load_n(&w->jobsRun, __ATOMIC_RELAXED);
+        copy.busyNs = __atomic_load_n(&w->busyNs, __ATOMIC_RELAXED);
+        copy.idleNs = __atomic_load_n(&w->idleNs, __ATOMIC_RELAXED);
+        copy.steals = __atomic_load_n(&w->steals, __ATOMIC_RELAXED);
+        copy.parks = __atomic_load_n(&w->parks, __ATOMIC_RELAXED);
+        for (uint32_t b = 0; b < WORK_STATS_BUCKETS; ++b) {
+            copy.queueDelay[b] = __atomic_load_n(&w->queueDelay[b], __ATOMIC_RELAXED);
+        }
+
+        if ((perWorker != NULL) && (i < count)) {
+            perWorker[i] = copy;
+        }
+        if (pool != NULL) {
+            pool->total.jobsRun += copy.jobsRun;
+            pool->total.busyNs += copy.busyNs;
+            pool->total.idleNs += copy.idleNs;
+            pool->total.steals += copy.steals;
+            pool->total.parks += copy.parks;
+            for (uint32_t b = 0; b < WORK_STATS_BUCKETS; ++b) {
+                pool->total.queueDelay[b] += copy.queueDelay[b];
+            }
+        }
+    }
+
+    return slots;
+}
@@ -1,30 +1,298 @@
 #ifndef WORKERPOOL_H
 #define WORKERPOOL_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*
- * Maximum number of outstanding jobs
+ * Maximum number of outstanding jobs (per job queue)
  */
 #define MAX_JOBS 10
 
+/*
+ * Maximum number of NUMA nodes that get their own job queue.
+ */
+#define MAX_NODES 8
+
+/*
+ * Node hint for jobs that may run anywhere.
+ */
+#define WORK_ANY_NODE (-1)
+
+/*
+ * Job priorities. Each priority has its own lane in every job queue. Workers
+ * always take jobs from the most urgent non-empty lane, unless a less urgent
+ * lane has been passed over too often (see starvationLimit).
+ */
+typedef enum _WorkPriority {
+    WORK_PRIORITY_LOW = -1,
+    WORK_PRIORITY_NORMAL = 0,
+    WORK_PRIORITY_HIGH = 1
+} WorkPriority;
+
+#define WORK_PRIORITY_LANES 3
+
+/*
+ * Default for WorkerPoolConfig.starvationLimit.
+ */
+#define WORK_STARVATION_LIMIT 16
+
+/*
+ * Number of buckets of the queueing delay histogram. Bucket i counts jobs
+ * that waited between 2^i and 2^(i+1) - 1 ns, the last bucket everything
+ * above.
+ */
+#define WORK_STATS_BUCKETS 40
+
+/*
+ * Size of the payload buffer embedded in every work item. Payloads up to this
+ * size are copied into the ringbuffer and need no heap allocation.
+ */
+#define WORK_INLINE_PAYLOAD 48
+
 typedef void (*WorkFunc)(int arg);
 
+/*
+ * Job function for context jobs. The context pointer is handed through
+ * unchanged. The payload points to the job's payload, which is only valid
+ * while the function runs. It is NULL if the job was submitted without one.
+ */
+typedef void (*WorkCtxFunc)(void *context, void *payload);
+
+/*
+ * Releases a payload that was handed over with submitWorkOwned().
+ */
+typedef void (*PayloadFree)(void *payload);
+
 typedef struct _WorkItem {
     /*
-     * The function that the worker should execute for this item.
+     * The function that the worker should execute for this item. Only one of
+     * func and ctxFunc is set.
      */
     WorkFunc func;
+    WorkCtxFunc ctxFunc;
     /*
      * The argument for the job.
      */
     int arg;
+    /*
+     * Context pointer for ctxFunc. The pool never dereferences it.
+     */
+    void *context;
+    /*
+     * Payload that is owned by the work item and released with freePayload
+     * after the job ran. NULL if the payload is stored inline.
+     */
+    void *ownedPayload;
+    PayloadFree freePayload;
+    /*
+     * Number of bytes used in inlinePayload.
+     */
+    size_t payloadSize;
+    /*
+     * Submission time in ns (CLOCK_MONOTONIC). Only set if the pool collects
+     * statistics.
+     */
+    uint64_t submitNs;
+    /*
+     * Inline payload storage for small payloads.
+     */
+    _Alignas(16) unsigned char inlinePayload[WORK_INLINE_PAYLOAD];
 } WorkItem;
 
+/*
+ * Configuration for initializeWorkerPoolEx().
+ */
+typedef struct _WorkerPoolConfig {
+    /*
+     * Number of workers that are started right away and that are kept alive
+     * while the pool is idle.
+     */
+    uint32_t minWorkers;
+    /*
+     * Upper bound for the number of workers. If this is larger than
+     * minWorkers, the pool starts additional workers while jobs queue up and
+     * retires them again after idleTimeoutMs without work.
+     */
+    uint32_t maxWorkers;
+    /*
+     * Number of pause iterations an idle worker polls the queue before it
+     * parks on a futex. 0 parks right away.
+     */
+    uint32_t spinIterations;
+    /*
+     * Time in milliseconds a parked worker above minWorkers waits for work
+     * before it exits. Must not be 0 if maxWorkers exceeds minWorkers.
+     */
+    uint32_t idleTimeoutMs;
+    /*
+     * CPUs the workers may run on. If numCpus is 0, all CPUs of the process'
+     * affinity mask are used. Workers are assigned to these CPUs round robin.
+     */
+    const int *cpus;
+    uint32_t numCpus;
+    /*
+     * If set, each worker is pinned to its single CPU. Otherwise it may run
+     * on all CPUs of its NUMA node (numaQueues) or all CPUs in cpus.
+     */
+    int pinWorkers;
+    /*
+     * If set, the pool keeps one job queue per NUMA node. Priority beats
+     * locality: workers select the priority lane over all queues and prefer
+     * their own node's queue only within that lane. A job whose queue is
+     * full spills over to the queue of another node.
+     */
+    int numaQueues;
+    /*
+     * Number of times a non-empty lane may be passed over in favor of more
+     * urgent jobs before it gets to run one job. 0 selects
+     * WORK_STARVATION_LIMIT.
+     */
+    uint32_t starvationLimit;
+    /*
+     * If set, workers keep the counters returned by getWorkerPoolStats().
+     * This costs a few clock reads per job.
+     */
+    int collectStats;
+} WorkerPoolConfig;
+
+/*
+ * Counters of a single worker slot. Workers that retire and are restarted in
+ * the same slot keep counting.
+ */
+typedef struct _WorkerStats {
+    uint64_t jobsRun;
+    /*
+     * Time spent running jobs and waiting for jobs.
+     */
+    uint64_t busyNs;
+    uint64_t idleNs;
+    /*
+     * Jobs taken from the queue of another NUMA node.
+     */
+    uint64_t steals;
+    /*
+     * Number of times the worker blocked because there was no work.
+     */
+    uint64_t parks;
+    /*
+     * Time between submission and start of the jobs, see WORK_STATS_BUCKETS.
+     */
+    uint64_t queueDelay[WORK_STATS_BUCKETS];
+} WorkerStats;
+
+/*
+ * Pool wide counters.
+ */
+typedef struct _WorkerPoolStats {
+    uint32_t numWorkers;
+    /*
+     * Number of queued jobs at the time of the snapshot and the maximum since
+     * initialization.
+     */
+    uint32_t queueDepth;
+    uint32_t maxQueueDepth;
+    /*
+     * Sum of the counters of all worker slots.
+     */
+    WorkerStats total;
+} WorkerPoolStats;
+
+/*
+ * Per-submission options for the submitWork*Ex() routines. Passing NULL
+ * selects the defaults. Initialize options with WORK_OPTIONS_DEFAULT and
+ * change the fields you need: node 0 is a valid node, so options that are
+ * initialized with only some fields given pin the job to node 0.
+ */
+typedef struct _WorkOptions {
+    /*
+     * NUMA node that should run the job, e.g., because it touches memory that
+     * is local to that node. WORK_ANY_NODE queues the job on the submitter's
+     * node. This is only a preference: workers of other nodes run the job
+     * before less urgent jobs of their own queue, and the job goes to another
+     * node's queue if the node's queue is full. Must always be set.
+     */
+    int node;
+    /*
+     * Priority of the job. Defaults to WORK_PRIORITY_NORMAL.
+     */
+    WorkPriority priority;
+} WorkOptions;
+
+/*
+ * Initializer for WorkOptions with the defaults, e.g.
+ *   WorkOptions options = WORK_OPTIONS_DEFAULT;
+ *   options.priority = WORK_PRIORITY_HIGH;
+ */
+#define WORK_OPTIONS_DEFAULT \
+    {.node = WORK_ANY_NODE, .priority = WORK_PRIORITY_NORMAL}
+
 int initializeWorkerPool(void);
+
+/*
+ * Initializes the worker pool in adaptive mode. Idle workers spin for a short
+ * time before they park, and the number of workers follows the queue depth
+ * within [minWorkers, maxWorkers]. Workers are placed on CPUs and NUMA nodes
+ * as described by the configuration.
+ * Returns -1 on error, 0 otherwise.
+ */
+int initializeWorkerPoolEx(const WorkerPoolConfig *config);
 void finalizeWorkerPool(void);
 
 int getWorkerId(void);
 
+/*
+ * Returns the NUMA node of the current worker thread or -1 for threads that
+ * are not part of the pool.
+ */
+int getWorkerNode(void);
+
+/*
+ * Returns the number of job queues, i.e., the number of NUMA nodes if the
+ * pool was initialized with numaQueues, 1 otherwise.
+ */
+uint32_t getNumNodes(void);
+
+/*
+ * Returns the number of currently running worker threads.
+ */
+uint32_t getNumWorkers(void);
+
+/*
+ * Takes a snapshot of the pool counters. The pool wide counters are written
+ * to pool and the counters of the first count worker slots to perWorker.
+ * Either may be NULL. Unless the pool was initialized with collectStats,
+ * only the queue counters of pool are filled and no slot is reported.
+ * Returns the number of worker slots.
+ */
+uint32_t getWorkerPoolStats(WorkerPoolStats *pool, WorkerStats *perWorker,
+                            uint32_t count);
+
 int submitWork(WorkFunc func, int arg);
+int submitWorkEx(const WorkOptions *options, WorkFunc func, int arg);
+
+/*
+ * Submits a context job. The size bytes at payload are copied into the work
+ * item, so the caller may reuse its buffer right away. Fails if size exceeds
+ * WORK_INLINE_PAYLOAD; use submitWorkOwned() for larger payloads.
+ * Returns -1 on error, 0 otherwise.
+ */
+int submitWorkCtx(WorkCtxFunc func, void *context,
+                  const void *payload, size_t size);
+int submitWorkCtxEx(const WorkOptions *options, WorkCtxFunc func,
+                    void *context, const void *payload, size_t size);
+
+/*
+ * Submits a context job and moves ownership of payload into the pool. The
+ * caller must not touch payload after a successful call; the pool releases it
+ * with freePayload (or free() if freePayload is NULL) once the job ran or the
+ * pool is finalized. On error, ownership stays with the caller.
+ * Returns -1 on error, 0 otherwise.
+ */
+int submitWorkOwned(WorkCtxFunc func, void *context,
+                    void *payload, PayloadFree freePayload);
+int submitWorkOwnedEx(const WorkOptions *options, WorkCtxFunc func,
+                      void *context, void *payload, PayloadFree freePayload);
 
 #endif
 
@@ -0,0 +1,121 @@
+#include "dispatcher.h"
+#include "context_switch.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <x86intrin.h>
+
+/*
+ * Benchmark for the dispatcher. Build with:
+ *   gcc -O2 -o bench bench.c dispatcher.c context_switch.S
+ */
+
+/*
+ * Number of yields each benchmark thread performs.
+ */
+#define YIELDS 100000
+
+/*
+ * Number of round trips for the raw context switch benchmark.
+ */
+#define SWITCH_ROUNDS 1000000
+
+static volatile int _finished;
+
+typedef void *(*SwitchFunc)(void **saveSp, void *newSp, void *transfer);
+
+static void *_mainSp;
+static void *_pingSp;
+static _Alignas(16) char _pingStack[16 * 1024];
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void yield_loop(void)
+{
+    for (int i = 0; i < YIELDS; ++i) {
+        yield();
+    }
+    _finished++;
+}
+
+/*
+ * Switches straight back to main, forever.
+ */
+static void ping(void *transfer, void *arg)
+{
+    SwitchFunc sw = *(SwitchFunc*)arg;
+    (void)transfer;
+    for (;;) {
+        sw(&_pingSp, _mainSp, NULL);
+    }
+}
+
+/*
+ * Measures the cost of a bare switch between two contexts, without any
+ * scheduling, in TSC cycles.
+ */
+static double cycles_per_switch(SwitchFunc sw)
+{
+    _pingSp = initContext(_pingStack + sizeof(_pingStack), ping, &sw);
+    sw(&_mainSp, _pingSp, NULL);
+
+    uint64_t start = __rdtsc();
+    for (int i = 0; i < SWITCH_ROUNDS; ++i) {
+        sw(&_mainSp, _pingSp, NULL);
+    }
+    uint64_t cycles = __rdtsc() - start;
+
+    // Every round trip consists of two switches.
+    return (double)cycles / (2.0 * SWITCH_ROUNDS);
+}
+
+int main()
+{
+    printf("Raw context switch, %d round trips\n", SWITCH_ROUNDS);
+    printf("  callee-saved registers:       %6.1f cycles\n",
+           cycles_per_switch(switchContext));
+    printf("  plus x87 control word, MXCSR: %6.1f cycles\n",
+           cycles_per_switch(switchContextFpu));
+
+    int counts[] = {2, 16, 128, 1024};
+    static int tids[1024];
+
+    initThreads();
+    printf("Context switches per second, %d yields per thread\n", YIELDS);
+
+    for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        _finished = 0;
+        for (int i = 0; i < counts[c]; ++i) {
+            tids[i] = startThread(yield_loop);
+            if (tids[i] == -1) {
+                printf("Failed to start thread %d\n", i);
+                return 1;
+            }
+        }
+
+        // Thread 0 takes part in the rotation until all threads are done.
+        long switches = 0;
+        double start = now_s();
+        while (_finished < counts[c]) {
+            yield();
+            switches++;
+        }
+        double elapsed = now_s() - start;
+
+        for (int i = 0; i < counts[c]; ++i) {
+            joinThread(tids[i]);
+        }
+
+        // Every yield of a benchmark thread is one switch, plus those of
+        // thread 0.
+        switches += (long)counts[c] * YIELDS;
+        printf("%5d threads: %12.0f switches/s\n", counts[c], switches / elapsed);
+    }
+
+    return 0;
+}
@@ -1,27 +1,70 @@
 #include "dispatcher.h"
+#include "context_switch.h"
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Set to 1 to print every context switch */
+#define DISPATCH_DEBUG 0
+
+/*
+ * Set to 1 to preserve the x87 control word and MXCSR across switches. Only
+ * needed if threads change rounding modes or floating point exception masks.
+ */
+#define DISPATCH_SAVE_FPU 0
+
+#if DISPATCH_SAVE_FPU
+#define _switchContext switchContextFpu
+#else
+#define _switchContext switchContext
+#endif
+
+/*
+ * The thread table starts with room for this many threads and doubles in
+ * size whenever it is full, up to MAX_THREADS.
+ */
+#define INITIAL_THREADS 16
+#define MAX_THREADS (1 << 20)
 
 /*
- * We currently support 10 threads at maximum
+ * The stack size of a single user-level thread (64 KiB = 16 pages). Stacks
+ * are mapped lazily, so a thread only consumes the pages it actually touches.
  */
-#define MAX_THREADS 10
+#define STACK_SIZE (64 * 1024)
 
 /*
- * The stack size of a single user-level thread (4 KiB = 1 page)
+ * Maximum number of stacks kept for reuse after their threads exited.
  */
-#define STACK_SIZE 4096
+#define STACK_CACHE_SIZE 64
+
+/*
+ * While threads sleep, yield() checks for expired timers on every switch.
+ * While threads wait for file descriptors, it polls epoll every
+ * IO_POLL_INTERVAL switches or IO_POLL_PERIOD_NS, whichever comes first. This
+ * keeps the system call off most switches.
+ */
+#define IO_POLL_INTERVAL 64
+#define IO_POLL_PERIOD_NS 1000000
+
+/*
+ * Maximum number of epoll events handled per poll.
+ */
+#define MAX_EVENTS 64
 
 typedef enum _ThreadState {
   STATE_UNUSED = 0, // This entry in the _threads array is unused.
   STATE_READY,      // The thread is ready to run
-  STATE_RUNNING     // The thread is currently running. _currentThread will
+  STATE_RUNNING,    // The thread is currently running. _currentThread will
                     // hold the thread's id.
-
-  // No waiting state so far.
+  STATE_WAITING,    // The thread is blocked and not in the ready queue
+  STATE_FINISHED    // The thread has exited and waits to be joined. Its
+                    // stack has already been released.
 } ThreadState;
 
 typedef struct _Thread {
@@ -39,6 +82,33 @@ typedef struct _Thread {
    * The stack pointer of this thread while it is not running.
    */
   void *currentSP;
+
+  /*
+   * The id of the next thread in the queue this thread is on (the ready
+   * queue or a wait queue), or -1 if this thread is the last one.
+   */
+  int next;
+
+  /*
+   * The id of the thread blocked in joinThread() on this thread, or -1.
+   */
+  int joiner;
+
+  /*
+   * Time (CLOCK_MONOTONIC, in ns) at which a sleeping thread wakes up.
+   */
+  uint64_t wakeNs;
+
+  /*
+   * The events reported for the file descriptor the thread waits on.
+   */
+  uint32_t ioEvents;
+
+  /*
+   * The usable (lowest) address of the thread's stack. NULL for thread 0,
+   * which runs on the stack of the kernel-level thread.
+   */
+  void *stackBase;
 } Thread;
 
 /*
@@ -46,13 +116,298 @@ typedef struct _Thread {
  */
 int _currentThread;
 
-Thread _threads[MAX_THREADS];
+/*
+ * The thread table. It holds _numThreadSlots entries and is reallocated when
+ * startThread() finds no unused entry.
+ */
+Thread *_threads = NULL;
+int _numThreadSlots = 0;
+
+/*
+ * FIFO of threads, linked through Thread.next. We link by id instead of by
+ * pointer, because growing the table moves the entries. Both are -1 if the
+ * queue is empty. A thread is on at most one queue at a time.
+ */
+typedef struct _ThreadQueue {
+  int head;
+  int tail;
+} ThreadQueue;
+
+/*
+ * All threads in STATE_READY.
+ */
+static ThreadQueue _ready = {-1, -1};
+
+/*
+ * Sleeping threads as a binary min-heap ordered by Thread.wakeNs.
+ */
+static int *_sleepers = NULL;
+static int _numSleepers = 0;
+static int _sleepersCapacity = 0;
+
+/*
+ * The epoll instance for waitFd() and the number of threads waiting in it.
+ */
+static int _epollFd = -1;
+static int _numIoWaiters = 0;
+
+/*
+ * Switches and time since epoll was last polled, see IO_POLL_INTERVAL.
+ */
+static unsigned _switchesSincePoll = 0;
+static uint64_t _lastPollNs = 0;
+
+/*
+ * Stacks of exited threads, ready to be handed out again.
+ */
+static void *_stackCache[STACK_CACHE_SIZE];
+static int _numCachedStacks = 0;
+
+/*
+ * Stack of a thread that just exited. A thread cannot release the stack it is
+ * running on, so the next thread releases it right after the switch.
+ */
+static void *_deadStack = NULL;
+
+/*
+ * Size of a page, which is also the size of the guard page below each stack.
+ */
+static size_t _pageSize = 0;
+
+/*
+ * Returns a stack of STACK_SIZE bytes. The stack is taken from the cache if
+ * possible. Otherwise, we reserve a new region with mmap(). The page below the
+ * stack stays inaccessible as guard page, so an overflow faults instead of
+ * silently corrupting the neighboring mapping. The kernel only commits
+ * memory for pages the thread actually touches.
+ * Returns NULL on error.
+ */
+static void *_allocStack() {
+  if (_numCachedStacks > 0) {
+    return _stackCache[--_numCachedStacks];
+  }
+
+  void *region = mmap(NULL, STACK_SIZE + _pageSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (region == MAP_FAILED) {
+    return NULL;
+  }
+  if (mprotect(region, _pageSize, PROT_NONE) != 0) {
+    munmap(region, STACK_SIZE + _pageSize);
+    return NULL;
+  }
+  return (char *)region + _pageSize;
+}
+
+/*
+ * Returns a stack from _allocStack() to the cache, or unmaps it if the cache
+ * is full.
+ */
+static void _freeStack(void *stackBase) {
+  if (_numCachedStacks < STACK_CACHE_SIZE) {
+    _stackCache[_numCachedStacks++] = stackBase;
+    return;
+  }
+  munmap((char *)stackBase - _pageSize, STACK_SIZE + _pageSize);
+}
+
+/*
+ * Doubles the size of the thread table.
+ * Returns -1 on error, 0 otherwise.
+ */
+static int _growThreads() {
+  int slots = (_numThreadSlots == 0) ? INITIAL_THREADS : 2 * _numThreadSlots;
+  if (slots > MAX_THREADS) {
+    return -1;
+  }
+
+  Thread *threads = realloc(_threads, slots * sizeof(Thread));
+  if (threads == NULL) {
+    return -1;
+  }
+  memset(threads + _numThreadSlots, 0,
+         (slots - _numThreadSlots) * sizeof(Thread));
+
+  _threads = threads;
+  _numThreadSlots = slots;
+  return 0;
+}
+
+/*
+ * Appends a thread to the tail of the queue.
+ */
+static void _enqueueThread(ThreadQueue *q, int threadId) {
+  _threads[threadId].next = -1;
+  if (q->tail == -1) {
+    q->head = threadId;
+  } else {
+    _threads[q->tail].next = threadId;
+  }
+  q->tail = threadId;
+}
+
+/*
+ * Removes and returns the thread at the head of the queue.
+ * Returns -1 if the queue is empty.
+ */
+static int _dequeueThread(ThreadQueue *q) {
+  int threadId = q->head;
+  if (threadId != -1) {
+    q->head = _threads[threadId].next;
+    if (q->head == -1) {
+      q->tail = -1;
+    }
+  }
+  return threadId;
+}
+
+/*
+ * Moves a waiting thread to the ready queue.
+ */
+static void _wakeThread(int threadId) {
+  assert(_threads[threadId].state == STATE_WAITING);
+  _threads[threadId].state = STATE_READY;
+  _enqueueThread(&_ready, threadId);
+}
+
+static uint64_t _nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Adds a thread to the sleeper heap.
+ * Returns -1 on error, 0 otherwise.
+ */
+static int _pushSleeper(int threadId) {
+  if (_numSleepers == _sleepersCapacity) {
+    int capacity = (_sleepersCapacity == 0) ? 16 : 2 * _sleepersCapacity;
+    int *sleepers = realloc(_sleepers, capacity * sizeof(int));
+    if (sleepers == NULL) {
+      return -1;
+    }
+    _sleepers = sleepers;
+    _sleepersCapacity = capacity;
+  }
+
+  // Sift up.
+  uint64_t wakeNs = _threads[threadId].wakeNs;
+  int i = _numSleepers++;
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (_threads[_sleepers[parent]].wakeNs <= wakeNs) {
+      break;
+    }
+    _sleepers[i] = _sleepers[parent];
+    i = parent;
+  }
+  _sleepers[i] = threadId;
+  return 0;
+}
+
+/*
+ * Removes the sleeper with the earliest wake up time from the heap.
+ */
+static void _popSleeper() {
+  int last = _sleepers[--_numSleepers];
+  uint64_t wakeNs = _threads[last].wakeNs;
+
+  // Sift down.
+  int i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= _numSleepers) {
+      break;
+    }
+    if ((child + 1 < _numSleepers) &&
+        (_threads[_sleepers[child + 1]].wakeNs <
+         _threads[_sleepers[child]].wakeNs)) {
+      child++;
+    }
+    if (wakeNs <= _threads[_sleepers[child]].wakeNs) {
+      break;
+    }
+    _sleepers[i] = _sleepers[child];
+    i = child;
+  }
+  _sleepers[i] = last;
+}
+
+/*
+ * Wakes up all sleepers that are due at the given time.
+ */
+static void _wakeSleepers(uint64_t now) {
+  while ((_numSleepers > 0) && (_threads[_sleepers[0]].wakeNs <= now)) {
+    _wakeThread(_sleepers[0]);
+    _popSleeper();
+  }
+}
+
+/*
+ * Wakes up sleepers whose time has come and threads whose file descriptors
+ * became ready. If block is set and nothing is ready, this waits until the
+ * next sleeper is due or a file descriptor becomes ready.
+ */
+static void _pollEvents(int block) {
+  uint64_t now = _nowNs();
+  _wakeSleepers(now);
+  if ((_ready.head != -1) || (_epollFd == -1)) {
+    block = 0;
+  }
+  if ((!block) &&
+      ((_numIoWaiters == 0) ||
+       ((++_switchesSincePoll < IO_POLL_INTERVAL) &&
+        (now - _lastPollNs < IO_POLL_PERIOD_NS)))) {
+    return;
+  }
+  _switchesSincePoll = 0;
+  _lastPollNs = now;
+
+  // Round the time to the next sleeper up to full milliseconds, so we do
+  // not wake up too early.
+  int timeout = 0;
+  if (block) {
+    timeout = -1;
+    if (_numSleepers > 0) {
+      timeout = (_threads[_sleepers[0]].wakeNs - now + 999999) / 1000000;
+    }
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(_epollFd, events, MAX_EVENTS, timeout);
+  for (int i = 0; i < n; ++i) {
+    int threadId = events[i].data.u32;
+    _threads[threadId].ioEvents = events[i].events;
+    _numIoWaiters--;
+    _wakeThread(threadId);
+  }
+
+  if (block) {
+    // Sleepers may have become due while we waited.
+    _wakeSleepers(_nowNs());
+  }
+}
 
 /*
  * Called once from main() to initialize our user-level thread implementation
  */
 void initThreads() {
-  memset(_threads, 0, sizeof(_threads));
+  _pageSize = sysconf(_SC_PAGESIZE);
+
+  free(_threads);
+  _threads = NULL;
+  _numThreadSlots = 0;
+  _ready.head = -1;
+  _ready.tail = -1;
+  _numSleepers = 0;
+  _numIoWaiters = 0;
+  if (_epollFd == -1) {
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+  }
+  if ((_growThreads() != 0) || (_epollFd == -1)) {
+    abort();
+  }
 
   // We use the user-mode part of the current kernel-level thread as the
   // first user-level thread. We therefore, do not need to setup a stack,
@@ -61,22 +416,35 @@ void initThreads() {
 
   _threads[0].state = STATE_RUNNING;
   _threads[0].threadId = 0;
+  _threads[0].joiner = -1;
   // Cannot set stack pointer, because thread 0 is still running (and the
   // stack pointer is thus changing constantly). The stack pointer can only
   // be set in yield().
 }
 
+static void _block();
+
 /*
- * When a thread exits its main function, it usually has to be terminated.
- * That is, its data structures including its stack have to be freed and the
- * thread needs to be removed from the scheduling. To ease our world, we let
- * the thread fall into parkThread() when it exits its main function.
- * parkThread() then lets the thread indefinitely yield() so we do not need to
- * perform any clean up. We thus do not really terminate the thread.
+ * When a thread returns from its main function, _threadStart() calls
+ * _exitThread(). The thread is taken out of the scheduling for good, a thread
+ * waiting in joinThread() is woken up, and the stack is handed to the next
+ * thread for release. The table entry stays in STATE_FINISHED until the thread is
+ * joined.
  */
-void _parkThread() {
-  while (1)
-    yield();
+void _exitThread() {
+  Thread *self = &_threads[_currentThread];
+  assert(_currentThread != 0);
+
+  self->state = STATE_FINISHED;
+  if (self->joiner != -1) {
+    _wakeThread(self->joiner);
+  }
+
+  _deadStack = self->stackBase;
+  self->stackBase = NULL;
+
+  _block();
+  assert(!"_block() should never return to a finished thread");
 }
 
 /*
@@ -88,15 +456,64 @@ static void _scheduleNextThread() {
 
   _threads[_currentThread].state = STATE_READY;
 
-  // Simple O(n) round-robin scheduling policy. Find the next ready thread
-  // and set it to running.
-  do {
-    _currentThread++;
-    _currentThread %= MAX_THREADS;
-  } while (_threads[_currentThread].state != STATE_READY);
+  // Round-robin scheduling policy in O(1). The current thread goes to the
+  // tail of the ready queue and the thread at the head runs next. If no other
+  // thread is ready, this picks the current thread again.
+  _enqueueThread(&_ready, _currentThread);
+  _currentThread = _dequeueThread(&_ready);
   _threads[_currentThread].state = STATE_RUNNING;
 }
 
+/*
+ * Releases the stack of a thread that exited. Runs on the new thread's stack
+ * right after every switch.
+ */
+static void _afterSwitch() {
+  if (_deadStack != NULL) {
+    _freeStack(_deadStack);
+    _deadStack = NULL;
+  }
+}
+
+/*
+ * Switches from prevThread to _currentThread, which the caller has already
+ * set to STATE_RUNNING. Returns once prevThread is scheduled again.
+ */
+static void _switchThreads(int prevThread) {
+#if DISPATCH_DEBUG
+  printf("Switch from thread %d with sp near %p\n", prevThread, &prevThread);
+  printf("Switch to thread %d with sp=%p\n", _currentThread,
+         _threads[_currentThread].currentSP);
+#endif
+
+  assert(_threads[_currentThread].state == STATE_RUNNING);
+  assert(_threads[_currentThread].currentSP != NULL);
+
+  // The switch itself lives in context_switch.S. It saves the callee-saved
+  // registers on the old stack and restores them from the new one. The
+  // thread table may move while prevThread is suspended, so its entry is
+  // only looked up here.
+  _switchContext(&_threads[prevThread].currentSP,
+                 _threads[_currentThread].currentSP, NULL);
+
+  // We are running on the new thread's stack now. If we switched away from
+  // a thread that exited, its stack is no longer in use.
+  _afterSwitch();
+}
+
+/*
+ * Entry point of every new thread. The first switch to a thread lands here
+ * instead of in _switchThreads().
+ */
+static void _threadStart(void *transfer, void *arg) {
+  (void)transfer;
+  void (*func)(void) = (void (*)(void))arg;
+
+  _afterSwitch();
+  func();
+  _exitThread();
+}
+
 /*
  * Switches to the next thread.
  */
@@ -104,43 +521,69 @@ void yield() {
   // Apply a scheduling policy to decide which user-level thread to run next.
   // This will update _currentThread to the next thread!
   int prevThread = _currentThread;
+
+  // Let sleepers and I/O waiters that became ready take part in this round.
+  if ((_numSleepers > 0) || (_numIoWaiters > 0)) {
+    _pollEvents(0);
+  }
   _scheduleNextThread();
 
-  printf("Switch from thread %d with sp near %p\n", prevThread, &prevThread);
-  printf("Switch to thread %d with sp=%p\n", _currentThread,
-         _threads[_currentThread].currentSP);
+  // No other thread is ready, keep running.
+  if (_currentThread == prevThread) {
+    return;
+  }
 
   assert(_threads[prevThread].state == STATE_READY);
-  assert(_threads[_currentThread].state == STATE_RUNNING);
-  assert(_threads[_currentThread].currentSP != NULL);
+  _switchThreads(prevThread);
+}
 
-  // Do the context switch
-  __asm__ __volatile__(
-      // -------------- Implement context switch here ---------------
+/*
+ * Switches away from the current thread, which has already left
+ * STATE_RUNNING and is not in the ready queue. If no thread is ready, the
+ * kernel-level thread waits for the next sleeper or file descriptor. Aborts
+ * if there is neither, because nobody could ever wake the threads up again.
+ */
+static void _block() {
+  int prevThread = _currentThread;
+  assert(_threads[prevThread].state != STATE_RUNNING);
 
-      // You can use %%rsp, %%rax, %%r8, etc. to access a register
-      // %[prevSp], %[newSp] get replaced by the previous and new thread
-      // stack pointers
-      "pushq %%rbp\n\t"
-      "pushq %%rbx\n\t"
-      "pushq %%r12\n\t"
-      "pushq %%r13\n\t"
-      "pushq %%r14\n\t"
-      "pushq %%r15\n\t"
-      "movq %%rsp, %%[prevSp]\n\t"
-      "movq %%[newSp], %%rsp\n\t"
-      "popq %%r15\n\t"
-      "popq %%r14\n\t"
-      "popq %%r13\n\t"
-      "popq %%r12\n\t"
-      "popq %%rbx\n\t"
-      "popq %%rbp\n\t"
+  while ((_currentThread = _dequeueThread(&_ready)) == -1) {
+    if ((_numSleepers == 0) && (_numIoWaiters == 0)) {
+      fprintf(stderr, "dispatcher: deadlock, no thread is ready to run\n");
+      abort();
+    }
+    _pollEvents(1);
+  }
+  _threads[_currentThread].state = STATE_RUNNING;
+  _switchThreads(prevThread);
+}
+
+/*
+ * Waits until the given thread has exited and releases its table entry.
+ * Returns -1 if the thread does not exist, is the calling thread or is
+ * already joined by another thread, 0 otherwise.
+ */
+int joinThread(int threadId) {
+  if ((threadId <= 0) || (threadId >= _numThreadSlots) ||
+      (threadId == _currentThread)) {
+    return -1;
+  }
 
-      "nop" // No-operation
+  Thread *target = &_threads[threadId];
+  if ((target->state == STATE_UNUSED) || (target->joiner != -1)) {
+    return -1;
+  }
 
-      : [prevSp] "=m"(_threads[prevThread].currentSP)
-      : [newSp] "m"(_threads[_currentThread].currentSP)
-      : "cc", "memory");
+  if (target->state != STATE_FINISHED) {
+    target->joiner = _currentThread;
+    _threads[_currentThread].state = STATE_WAITING;
+    _block();
+  }
+
+  // The thread table may have moved while we were blocked.
+  assert(_threads[threadId].state == STATE_FINISHED);
+  _threads[threadId].state = STATE_UNUSED;
+  return 0;
 }
 
 /*
@@ -153,51 +596,205 @@ int startThread(void (*func)(void)) {
     return -1;
   }
 
-  // Find a thread structure in our pre-allocated thread array, that we did
-  // not use, yet.
-  for (int i = 0; i < MAX_THREADS; ++i) {
-    if (_threads[i].state == STATE_UNUSED) {
-
-      // Allocate a stack for the user-level thread. For our purposes,
-      // a simple, fixed-size memory region as stack is sufficient. We
-      // can thus allocate stack space (i.e., memory space) from the
-      // heap.
-      void *stackBase = malloc(STACK_SIZE);
-      if (stackBase == NULL) {
-        return -1;
-      }
-
-      // Stacks grow from high addresses to low addresses. The stack thus
-      // effectively starts at the end of the allocated memory area and
-      // grows to the area's beginning.
-      // We here assume the stack to be an array of void*'s, that is
-      // pointers. A pointer has the right size (e.g., 32 or 64 bits) to
-      // hold a full CPU register and can receive function pointers
-      // without casting. stackTop is thus a pointer to pointers.
-      void **stackTop = (void **)(stackBase + STACK_SIZE);
-
-      // ------- Implement thread stack initialization here ---------
-
-      // Remember that stackTop-- decreases the stack pointer by 8 bytes.
-      stackTop--;
-      *stackTop = _parkThread;
-      stackTop--;
-      *stackTop = func;
-      stackTop--;
-      *stackTop = stackTop;
-
-      stackTop -= 5;
-
-      // ------------------------------------------------------------
-
-      // We initialized the stack and the thread is ready to run.
-      // After setting STATE_READY, the thread is eligible to dispatching
-      _threads[i].currentSP = stackTop;
-      _threads[i].state = STATE_READY;
-
-      return i;
+  // Find a thread structure in our thread table, that we did not use, yet.
+  // If there is none, we grow the table.
+  int i = 1;
+  while ((i < _numThreadSlots) && (_threads[i].state != STATE_UNUSED)) {
+    i++;
+  }
+  if ((i == _numThreadSlots) && (_growThreads() != 0)) {
+    return -1;
+  }
+
+  // Get a stack for the user-level thread. Stacks come from a cache of
+  // previously used stacks or are freshly mapped with a guard page.
+  void *stackBase = _allocStack();
+  if (stackBase == NULL) {
+    return -1;
+  }
+
+  // Stacks grow from high addresses to low addresses. The stack thus
+  // effectively starts at the end of the allocated memory area and
+  // grows to the area's beginning.
+  // initContext() places a frame at the top of the stack that looks like a
+  // suspended switch, so that the first switch to the thread calls
+  // _threadStart(), which runs func and then exits the thread.
+  void *stackTop =
+      initContext(stackBase + STACK_SIZE, _threadStart, (void *)func);
+
+  // We initialized the stack and the thread is ready to run.
+  // After setting STATE_READY, the thread is eligible to dispatching
+  _threads[i].threadId = i;
+  _threads[i].stackBase = stackBase;
+  _threads[i].currentSP = stackTop;
+  _threads[i].joiner = -1;
+  _threads[i].state = STATE_READY;
+  _enqueueThread(&_ready, i);
+
+  return i;
+}
+
+/*
+ * Blocks the current thread for at least ns nanoseconds. Other threads keep
+ * running in the meantime.
+ */
+void sleepThread(uint64_t ns) {
+  const uint64_t wakeNs = _nowNs() + ns;
+  _threads[_currentThread].wakeNs = wakeNs;
+  if (_pushSleeper(_currentThread) != 0) {
+    // We cannot keep track of the thread. Fall back to busy yielding. The
+    // thread table may move while we yield, so we keep no pointer into it.
+    while (_nowNs() < wakeNs) {
+      yield();
     }
+    return;
+  }
+  _threads[_currentThread].state = STATE_WAITING;
+  _block();
+}
+
+/*
+ * Blocks the current thread until the file descriptor is ready for one of
+ * the given epoll events (e.g., EPOLLIN). Other threads keep running in the
+ * meantime. Only one thread may wait on a file descriptor at a time.
+ * Returns the ready events or -1 on error.
+ */
+int waitFd(int fd, uint32_t events) {
+  struct epoll_event event;
+  event.events = events | EPOLLONESHOT;
+  event.data.u32 = _currentThread;
+  if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+    return -1;
+  }
+
+  _numIoWaiters++;
+  _threads[_currentThread].state = STATE_WAITING;
+  _block();
+
+  // The one-shot registration is disabled now. Remove it so the next wait on
+  // this descriptor can add it again.
+  epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, NULL);
+  return _threads[_currentThread].ioEvents;
+}
+
+/* Mutex and condition variable implementation */
+/* =========================================== */
+
+typedef struct _mutex {
+  // The thread holding the mutex, or -1.
+  int owner;
+  // Threads waiting for the mutex.
+  ThreadQueue waiting;
+} mutex;
+
+typedef struct _cond {
+  // Threads waiting for a signal.
+  ThreadQueue waiting;
+} cond;
+
+/*
+ * Allocate and initialize a new mutex.
+ * Returns NULL on error.
+ */
+mutex *mutexNew() {
+  mutex *m = malloc(sizeof(mutex));
+  if (m != NULL) {
+    m->owner = -1;
+    m->waiting = (ThreadQueue){-1, -1};
+  }
+  return m;
+}
+
+/*
+ * Lock the mutex. If the mutex is already locked, block the current thread.
+ */
+void mutexLock(mutex *m) {
+  assert(m->owner != _currentThread);
+  if (m->owner == -1) {
+    m->owner = _currentThread;
+    return;
+  }
+
+  _enqueueThread(&m->waiting, _currentThread);
+  _threads[_currentThread].state = STATE_WAITING;
+  _block();
+  // mutexUnlock() handed the mutex directly to us.
+  assert(m->owner == _currentThread);
+}
+
+/*
+ * Lock the mutex if it is free.
+ * Returns 0 if the mutex has been locked, 1 otherwise.
+ */
+int mutexTryLock(mutex *m) {
+  if (m->owner != -1) {
+    return 1;
+  }
+  m->owner = _currentThread;
+  return 0;
+}
+
+/*
+ * Unlock the mutex. The first waiting thread, if any, becomes the owner.
+ */
+void mutexUnlock(mutex *m) {
+  assert(m->owner == _currentThread);
+  m->owner = _dequeueThread(&m->waiting);
+  if (m->owner != -1) {
+    _wakeThread(m->owner);
+  }
+}
+
+void mutexFree(mutex *m) {
+  assert(m->owner == -1);
+  free(m);
+}
+
+/*
+ * Allocate and initialize a new condition variable.
+ * Returns NULL on error.
+ */
+cond *condNew() {
+  cond *c = malloc(sizeof(cond));
+  if (c != NULL) {
+    c->waiting = (ThreadQueue){-1, -1};
   }
+  return c;
+}
 
-  return -1;
-}
\ No newline at end of file
+/*
+ * Atomically unlock the mutex and wait for a signal. The mutex is locked
+ * again before this returns.
+ */
+void condWait(cond *c, mutex *m) {
+  _enqueueThread(&c->waiting, _currentThread);
+  _threads[_currentThread].state = STATE_WAITING;
+  mutexUnlock(m);
+  _block();
+  mutexLock(m);
+}
+
+/*
+ * Wake up one thread waiting on the condition variable.
+ */
+void condSignal(cond *c) {
+  int threadId = _dequeueThread(&c->waiting);
+  if (threadId != -1) {
+    _wakeThread(threadId);
+  }
+}
+
+/*
+ * Wake up all threads waiting on the condition variable.
+ */
+void condBroadcast(cond *c) {
+  int threadId;
+  while ((threadId = _dequeueThread(&c->waiting)) != -1) {
+    _wakeThread(threadId);
+  }
+}
+
+void condFree(cond *c) {
+  assert(c->waiting.head == -1);
+  free(c);
+}
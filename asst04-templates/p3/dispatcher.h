@@ -1,10 +1,32 @@
 #ifndef DISPATCHER_H
 #define DISPATCHER_H
 
+#include <stdint.h>
+
 void initThreads();
 
 void yield();
 
 int startThread(void (*func)(void));
 
+int joinThread(int threadId);
+
+void sleepThread(uint64_t ns);
+
+int waitFd(int fd, uint32_t events);
+
+typedef struct _mutex mutex;
+mutex *mutexNew();
+void mutexLock(mutex *m);
+int mutexTryLock(mutex *m);
+void mutexUnlock(mutex *m);
+void mutexFree(mutex *m);
+
+typedef struct _cond cond;
+cond *condNew();
+void condWait(cond *c, mutex *m);
+void condSignal(cond *c);
+void condBroadcast(cond *c);
+void condFree(cond *c);
+
 #endif
\ No newline at end of file
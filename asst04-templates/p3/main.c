@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <time.h>
+#include <sys/epoll.h>
 
 // This does return an address close to the top of the stack.
 void *getSp()
@@ -34,6 +36,66 @@ void t2()
     }
 }
 
+void t3()
+{
+    printf("Short thread: sp is %p\n", getSp());
+}
+
+mutex *m;
+cond *c;
+int items = 0;
+int consumed = 0;
+
+void producer()
+{
+    for (int i = 0; i < 3; i++) {
+        mutexLock(m);
+        items++;
+        condSignal(c);
+        mutexUnlock(m);
+        yield();
+    }
+}
+
+void consumer()
+{
+    for (int i = 0; i < 3; i++) {
+        mutexLock(m);
+        while (items == 0) {
+            condWait(c, m);
+        }
+        items--;
+        consumed++;
+        mutexUnlock(m);
+    }
+}
+
+uint64_t sleptNs = 0;
+
+uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void sleeper()
+{
+    uint64_t start = nowNs();
+    sleepThread(50000000);
+    sleptNs = nowNs() - start;
+}
+
+int pipeFds[2];
+int readyEvents = 0;
+char received = 0;
+
+void reader()
+{
+    readyEvents = waitFd(pipeFds[0], EPOLLIN);
+    read(pipeFds[0], &received, 1);
+}
+
 int main() {
     test_start("dispatcher.c");
     initThreads();
@@ -46,6 +108,53 @@ int main() {
     printf("Started thread: %d\n", tid2);
     test_equals_int(tid2, 2, "second thread gets tid 2");
 
+    // The thread table grows beyond its initial size.
+    int tid = 0;
+    for (int i = 0; i < 30; i++) {
+        tid = startThread(t3);
+    }
+    test_equals_int(tid, 32, "thread table grows on demand");
+
+    // Finished threads can be joined, which frees their table entries.
+    int joined = 0;
+    for (int i = 3; i <= tid; i++) {
+        joined += (joinThread(i) == 0);
+    }
+    test_equals_int(joined, 30, "joinThread succeeds for finished threads");
+    test_equals_int(joinThread(3), -1, "joinThread fails for joined thread");
+    test_equals_int(joinThread(0), -1, "joinThread fails for the calling thread");
+
+    tid = startThread(t3);
+    test_equals_int(tid, 3, "joined thread entry is reused");
+    test_equals_int(joinThread(tid), 0, "joinThread waits for the thread");
+
+    // Threads block on mutexes and condition variables instead of spinning.
+    m = mutexNew();
+    c = condNew();
+    int tidConsumer = startThread(consumer);
+    int tidProducer = startThread(producer);
+    joinThread(tidConsumer);
+    joinThread(tidProducer);
+    test_equals_int(consumed, 3, "consumer received all items");
+    test_equals_int(mutexTryLock(m), 0, "mutexTryLock locks free mutex");
+    test_equals_int(mutexTryLock(m), 1, "mutexTryLock fails on locked mutex");
+    mutexUnlock(m);
+    mutexFree(m);
+    condFree(c);
+
+    tid = startThread(sleeper);
+    joinThread(tid);
+    test_assert(sleptNs >= 50000000, "sleepThread sleeps long enough");
+
+    // A thread waiting for a file descriptor lets the others run.
+    pipe(pipeFds);
+    tid = startThread(reader);
+    yield();
+    write(pipeFds[1], "x", 1);
+    joinThread(tid);
+    test_assert(readyEvents & EPOLLIN, "waitFd reports readable descriptor");
+    test_equals_int(received, 'x', "reader got the data");
+
     yield();
     for (int i = 1; ; i++) {
         printf("Thread 0: Step %d, sp is %p\n", i, getSp());
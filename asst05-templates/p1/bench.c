@@ -0,0 +1,186 @@
+#include "strings.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Benchmark of the string functions against glibc. Build with:
+ *   gcc -O2 -o bench bench.c strings.c
+ */
+
+/*
+ * Total number of bytes processed per measurement.
+ */
+#define BYTES_PER_RUN (256 * 1024 * 1024)
+
+static volatile size_t _sink;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_length(size_t (*length)(const char*), const char *s, size_t len)
+{
+    size_t rounds = BYTES_PER_RUN / (len + 1);
+    double start = now_s();
+    for (size_t i = 0; i < rounds; i++) {
+        _sink += length(s);
+        __asm__ volatile("" ::: "memory");
+    }
+    return (double)rounds * len / (now_s() - start) / 1e9;
+}
+
+static char *glibc_concat(const char *s1, const char *s2)
+{
+    size_t len1 = strlen(s1), len2 = strlen(s2);
+    char *ret = malloc(len1 + len2 + 1);
+    if (ret == NULL) {
+        return NULL;
+    }
+    memcpy(ret, s1, len1);
+    memcpy(ret + len1, s2, len2 + 1);
+    return ret;
+}
+
+static double bench_concat(char *(*concat)(const char*, const char*), const char *s, size_t len)
+{
+    size_t rounds = BYTES_PER_RUN / (2 * len + 1);
+    double start = now_s();
+    for (size_t i = 0; i < rounds; i++) {
+        char *joined = concat(s, s);
+        _sink += joined[len];
+        free(joined);
+    }
+    return (double)rounds * 2 * len / (now_s() - start) / 1e9;
+}
+
+/*
+ * Size of the CSV-like input for the split benchmark.
+ */
+#define SPLIT_INPUT (8 * 1024 * 1024)
+#define SPLIT_ROUNDS 20
+
+static void bench_split(void)
+{
+    char *input = malloc(SPLIT_INPUT + 1);
+    if (input == NULL) {
+        return;
+    }
+    // Fields of 1 to 16 characters.
+    for (size_t i = 0; i < SPLIT_INPUT; i++) {
+        input[i] = (rand() % 9 == 0) ? ',' : 'a' + i % 26;
+    }
+    input[SPLIT_INPUT] = '\0';
+
+    double start = now_s();
+    for (int r = 0; r < SPLIT_ROUNDS; r++) {
+        char **parts = stringsplit(input, ',');
+        _sink += parts[1][0];
+        stringsplit_free(parts);
+    }
+    double copying = now_s() - start;
+
+    start = now_s();
+    for (int r = 0; r < SPLIT_ROUNDS; r++) {
+        size_t count;
+        StringSlice *slices = stringsplit_slices(input, ',', &count);
+        _sink += count;
+        free(slices);
+    }
+    double slicing = now_s() - start;
+
+    start = now_s();
+    for (int r = 0; r < SPLIT_ROUNDS; r++) {
+        StringSplitIterator it;
+        StringSlice slice;
+        stringsplit_iter_init(&it, input, ',');
+        while (stringsplit_iter_next(&it, &slice)) {
+            _sink += slice.length;
+        }
+    }
+    double iterating = now_s() - start;
+
+    double bytes = (double)SPLIT_INPUT * SPLIT_ROUNDS;
+    printf("\nSplitting %d MiB of comma separated fields\n", SPLIT_INPUT >> 20);
+    printf("  stringsplit:        %6.2f GB/s\n", bytes / copying / 1e9);
+    printf("  stringsplit_slices: %6.2f GB/s\n", bytes / slicing / 1e9);
+    printf("  split iterator:     %6.2f GB/s\n", bytes / iterating / 1e9);
+    free(input);
+}
+
+/*
+ * Number of fragments joined by the concatenation benchmark.
+ */
+#define FRAGMENTS 20000
+
+static void bench_fragments(void)
+{
+    const char *fragment = "<td>fragment</td>";
+    size_t fragmentLength = strlen(fragment);
+
+    double start = now_s();
+    char *joined = stringconcat("", "");
+    for (int i = 0; i < FRAGMENTS && joined != NULL; i++) {
+        char *next = stringconcat(joined, fragment);
+        free(joined);
+        joined = next;
+    }
+    double concatenating = now_s() - start;
+    free(joined);
+
+    start = now_s();
+    StringBuilder sb;
+    stringbuilder_init(&sb, 0);
+    for (int i = 0; i < FRAGMENTS; i++) {
+        stringbuilder_append_n(&sb, fragment, fragmentLength);
+    }
+    free(stringbuilder_finalize(&sb));
+    double building = now_s() - start;
+
+    start = now_s();
+    StringRope rope;
+    stringrope_init(&rope);
+    for (int i = 0; i < FRAGMENTS; i++) {
+        stringrope_append_n(&rope, fragment, fragmentLength);
+    }
+    free(stringrope_flatten(&rope));
+    stringrope_free(&rope);
+    double roping = now_s() - start;
+
+    printf("\nJoining %d fragments of %zu bytes\n", FRAGMENTS, fragmentLength);
+    printf("  repeated stringconcat: %10.3f ms\n", concatenating * 1e3);
+    printf("  string builder:        %10.3f ms\n", building * 1e3);
+    printf("  rope + flatten:        %10.3f ms\n", roping * 1e3);
+}
+
+int main()
+{
+    size_t lengths[] = {7, 64, 1000, 64 * 1024, 4 * 1024 * 1024};
+
+    printf("%10s %14s %14s %14s %14s\n", "length", "stringlength", "strlen",
+           "stringconcat", "strlen+memcpy");
+    for (unsigned i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        size_t len = lengths[i];
+        // Start one byte into the buffer to have an unaligned string.
+        char *buf = malloc(len + 2);
+        if (buf == NULL) {
+            return 1;
+        }
+        memset(buf, 'a', len + 1);
+        buf[len + 1] = '\0';
+        const char *s = buf + 1;
+
+        printf("%10zu %9.2f GB/s %9.2f GB/s %9.2f GB/s %9.2f GB/s\n", len,
+               bench_length(stringlength, s, len), bench_length(strlen, s, len),
+               bench_concat(stringconcat, s, len), bench_concat(glibc_concat, s, len));
+        free(buf);
+    }
+
+    bench_split();
+    bench_fragments();
+    return 0;
+}
@@ -1,7 +1,101 @@
 #include "testlib.h"
 #include "strings.h"
 
+#include <sys/mman.h>
+#include <unistd.h>
 
+/*
+ * Checks stringlength() and stringconcat() for all lengths up to maxLen at
+ * all offsets within a 64 byte block.
+ * Returns the number of mismatches.
+ */
+static int check_alignments(size_t maxLen)
+{
+    static _Alignas(64) char buf[512];
+    int errors = 0;
+
+    for (size_t offset = 0; offset < 64; offset++) {
+        for (size_t len = 0; len <= maxLen; len++) {
+            char *s = buf + offset;
+            for (size_t i = 0; i < len; i++) {
+                s[i] = 'a' + (i % 26);
+            }
+            s[len] = '\0';
+            // Junk after the terminator must not count.
+            s[len + 1] = 'x';
+
+            if (stringlength(s) != len) {
+                errors++;
+            }
+
+            char *joined = stringconcat(s, s + len / 2);
+            if ((joined == NULL) || (stringlength(joined) != len + (len - len / 2))) {
+                errors++;
+            } else {
+                for (size_t i = 0; i < len; i++) {
+                    if ((joined[i] != s[i]) || (joined[len + i / 2] != s[len / 2 + i / 2])) {
+                        errors++;
+                        break;
+                    }
+                }
+            }
+            free(joined);
+        }
+    }
+    return errors;
+}
+
+/*
+ * Compares stringsplit_slices() and the split iterator with stringsplit() for
+ * random strings of all lengths up to maxLen at all offsets within a 64 byte
+ * block.
+ * Returns the number of mismatches.
+ */
+static int check_slices(size_t maxLen)
+{
+    static _Alignas(64) char buf[512];
+    int errors = 0;
+
+    srand(42);
+    for (size_t offset = 0; offset < 64; offset++) {
+        for (size_t len = 0; len <= maxLen; len++) {
+            char *s = buf + offset;
+            for (size_t i = 0; i < len; i++) {
+                s[i] = (rand() % 4 == 0) ? ';' : 'a' + (i % 26);
+            }
+            s[len] = '\0';
+            s[len + 1] = ';';
+
+            char **parts = stringsplit(s, ';');
+            size_t count;
+            StringSlice *slices = stringsplit_slices(s, ';', &count);
+            StringSplitIterator it;
+            StringSlice slice;
+            stringsplit_iter_init(&it, s, ';');
+
+            size_t n = 0;
+            for (; parts[n] != NULL; n++) {
+                if ((n >= count) || (slices[n].length != stringlength(parts[n])) ||
+                    ((slices[n].length > 0) && (*slices[n].ptr != *parts[n]))) {
+                    errors++;
+                    break;
+                }
+                if (!stringsplit_iter_next(&it, &slice) || (slice.ptr != slices[n].ptr) ||
+                    (slice.length != slices[n].length)) {
+                    errors++;
+                    break;
+                }
+            }
+            if ((n != count) || stringsplit_iter_next(&it, &slice)) {
+                errors++;
+            }
+
+            stringsplit_free(parts);
+            free(slices);
+        }
+    }
+    return errors;
+}
 
 int main()
 {
@@ -19,5 +113,104 @@ int main()
     free(helloWorld);
     stringsplit_free(helloAndWorld);
 
+    test_equals_int(stringlength(""), 0, "stringlength works for the empty string");
+    test_equals_int(check_alignments(200), 0, "stringlength and stringconcat work for all lengths and alignments");
+
+    // Strings that end right before an unmapped page must not fault.
+    long pageSize = sysconf(_SC_PAGESIZE);
+    char *pages = mmap(NULL, 2 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    test_assert(pages != MAP_FAILED, "mmap two pages");
+    mprotect(pages + pageSize, pageSize, PROT_NONE);
+    int pageErrors = 0;
+    for (int len = 0; len < 100; len++) {
+        char *s = pages + pageSize - len - 1;
+        for (int i = 0; i < len; i++) {
+            s[i] = 'z';
+        }
+        s[len] = '\0';
+        if (stringlength(s) != (size_t)len) {
+            pageErrors++;
+        }
+        char *copy = stringconcat(s, "");
+        if ((copy == NULL) || (stringlength(copy) != (size_t)len)) {
+            pageErrors++;
+        }
+        free(copy);
+    }
+    test_equals_int(pageErrors, 0, "stringlength and stringconcat do not read past the end of a page");
+    munmap(pages, 2 * pageSize);
+
+    char **parts = stringsplit(",a,,bc,", ',');
+    test_equals_string(parts[0], "", "stringsplit keeps an empty first substring");
+    test_equals_string(parts[1], "a", "stringsplit returns 'a' as the second substring");
+    test_equals_string(parts[2], "", "stringsplit keeps empty substrings between delimiters");
+    test_equals_string(parts[3], "bc", "stringsplit returns 'bc' as the fourth substring");
+    test_equals_string(parts[4], "", "stringsplit keeps an empty last substring");
+    test_equals_ptr(parts[5], NULL, "stringsplit terminates the result after the last substring");
+    stringsplit_free(parts);
+
+    char *csv = "id;name;;value";
+    size_t count = 0;
+    StringSlice *slices = stringsplit_slices(csv, ';', &count);
+    test_equals_int(count, 4, "stringsplit_slices returns 4 slices for 'id;name;;value'");
+    test_assert(slices[0].ptr == csv && slices[0].length == 2, "stringsplit_slices points the first slice to 'id' in the input");
+    test_assert(slices[1].ptr == csv + 3 && slices[1].length == 4, "stringsplit_slices points the second slice to 'name' in the input");
+    test_equals_int(slices[2].length, 0, "stringsplit_slices returns an empty slice between two delimiters");
+    test_assert(slices[3].ptr == csv + 9 && slices[3].length == 5, "stringsplit_slices points the last slice to 'value' in the input");
+    free(slices);
+
+    StringSplitIterator it;
+    StringSlice slice;
+    stringsplit_iter_init(&it, "", ';');
+    test_assert(stringsplit_iter_next(&it, &slice) && slice.length == 0, "the split iterator returns one empty slice for the empty string");
+    test_assert(!stringsplit_iter_next(&it, &slice), "the split iterator ends after the last slice");
+
+    test_equals_int(check_slices(200), 0, "stringsplit_slices and the split iterator match stringsplit");
+
+    StringBuilder sb;
+    test_equals_int(stringbuilder_init(&sb, 0), 0, "stringbuilder_init works");
+    int builderErrors = 0;
+    for (int i = 0; i < 10000; i++) {
+        builderErrors += stringbuilder_append(&sb, "ab") != 0;
+        builderErrors += stringbuilder_append_n(&sb, "cdef", 1) != 0;
+    }
+    test_equals_int(builderErrors, 0, "stringbuilder_append works for 20000 fragments");
+    test_equals_int(sb.length, 30000, "the builder holds all appended bytes");
+    char *built = stringbuilder_finalize(&sb);
+    test_assert(built != NULL && stringlength(built) == 30000 && built[29997] == 'a' && built[29999] == 'c',
+                "stringbuilder_finalize returns the appended fragments in order");
+    test_assert(sb.data == NULL && sb.length == 0, "stringbuilder_finalize leaves the builder empty");
+    free(built);
+    test_equals_int(stringbuilder_append(&sb, "again"), 0, "a finalized builder can be used again");
+    built = stringbuilder_finalize(&sb);
+    test_equals_string(built, "again", "a reused builder starts out empty");
+    free(built);
+
+    StringRope rope, other;
+    stringrope_init(&rope);
+    stringrope_init(&other);
+    int ropeErrors = 0;
+    for (int i = 0; i < 30000; i++) {
+        ropeErrors += stringrope_append_n(&rope, "0123456789", 10) != 0;
+    }
+    char *big = malloc(200000);
+    for (int i = 0; i < 200000; i++) {
+        big[i] = 'x';
+    }
+    ropeErrors += stringrope_append_n(&other, "<", 1) != 0;
+    ropeErrors += stringrope_append_n(&other, big, 200000) != 0;
+    ropeErrors += stringrope_append_n(&other, ">", 1) != 0;
+    free(big);
+    stringrope_join(&rope, &other);
+    test_equals_int(ropeErrors, 0, "stringrope_append_n works for small and large pieces");
+    test_assert(rope.length == 500002 && other.length == 0 && other.head == NULL,
+                "stringrope_join moves the whole second rope");
+    char *flat = stringrope_flatten(&rope);
+    test_assert(flat != NULL && stringlength(flat) == 500002 && flat[299999] == '9' && flat[300000] == '<' &&
+                flat[300001] == 'x' && flat[500001] == '>', "stringrope_flatten returns the pieces in order");
+    free(flat);
+    stringrope_free(&rope);
+    test_assert(rope.head == NULL && rope.length == 0, "stringrope_free leaves the rope empty");
+
     return test_end();
 }
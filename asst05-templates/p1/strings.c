@@ -1,40 +1,295 @@
 #include "strings.h"
 
-/**
- * Returns the length of string s without counting the terminating null byte.
+#include <stdint.h>
+
+/* Set to 0 to use the portable byte-wise code only */
+#define STRINGS_SIMD 1
+
+#if STRINGS_SIMD && defined(__x86_64__)
+#include <immintrin.h>
+#define STRINGS_X86 1
+#else
+#define STRINGS_X86 0
+#endif
+
+/*
+ * Implementations picked on first use, depending on what the CPU supports.
+ */
+static size_t _lengthSelect(const char *s);
+static void _copySelect(char *dst, const char *src, size_t n);
+static uint64_t _splitMaskSelect(const char *block, int from, char delimiter);
+
+static size_t (*_length)(const char *s) = _lengthSelect;
+static void (*_copy)(char *dst, const char *src, size_t n) = _copySelect;
+static uint64_t (*_splitMask)(const char *block, int from,
+                              char delimiter) = _splitMaskSelect;
+
+/*
+ * The split functions look at the string in aligned blocks of this size.
+ */
+#define SPLIT_BLOCK 64
+
+/*
+ * Smallest buffer a string builder allocates.
+ */
+#define BUILDER_MIN_CAPACITY 64
+
+/*
+ * Size of the data area of a rope chunk. Larger appends get a chunk of
+ * their own.
+ */
+#define ROPE_CHUNK_SIZE (64 * 1024)
+
+#if !STRINGS_X86
+static size_t _lengthScalar(const char *s) {
+  const char *p = s;
+  while (*p) {
+    p++;
+  }
+  return p - s;
+}
+#endif
+
+static void _copyScalar(char *dst, const char *src, size_t n) {
+  while (n--) {
+    *dst++ = *src++;
+  }
+}
+
+#if !STRINGS_X86
+/*
+ * Returns a bit mask of the delimiters and null bytes in the aligned block,
+ * starting at byte from. Bits before from and after the first null byte are
+ * undefined: the scalar version skips them, the SIMD versions read the whole
+ * block.
+ */
+static uint64_t _splitMaskScalar(const char *block, int from, char delimiter) {
+  uint64_t mask = 0;
+  for (int i = from; i < SPLIT_BLOCK; i++) {
+    if (block[i] == delimiter) {
+      mask |= (uint64_t)1 << i;
+    } else if (block[i] == '\0') {
+      mask |= (uint64_t)1 << i;
+      break;
+    }
+  }
+  return mask;
+}
+#endif
+
+#if STRINGS_X86
+/*
+ * The SIMD length functions only ever read aligned blocks. An aligned block
+ * never crosses a page boundary, so reading the whole block that holds the
+ * terminator cannot fault, even if the string ends right before an unmapped
+ * page. Bytes in front of s in the first block are masked out. These reads
+ * look out of bounds to AddressSanitizer, so it is told to skip them.
+ */
+__attribute__((no_sanitize_address)) static size_t _lengthSse2(const char *s) {
+  uintptr_t offset = (uintptr_t)s & 15;
+  const __m128i *p = (const __m128i *)(s - offset);
+  const __m128i zero = _mm_setzero_si128();
+
+  unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(p), zero));
+  mask >>= offset;
+  if (mask != 0) {
+    return __builtin_ctz(mask);
+  }
+  for (;;) {
+    p++;
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(p), zero));
+    if (mask != 0) {
+      return (const char *)p - s + __builtin_ctz(mask);
+    }
+  }
+}
+
+/*
+ * Returns a bit mask of the zero bytes in the 64 bytes a and b.
+ */
+__attribute__((target("avx2"))) static inline uint64_t
+_zeroMaskAvx2(__m256i a, __m256i b, __m256i zero) {
+  uint64_t lo = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, zero));
+  uint64_t hi = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, zero));
+  return lo | (hi << 32);
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) static size_t
+_lengthAvx2(const char *s) {
+  uintptr_t offset = (uintptr_t)s & 31;
+  const char *p = s - offset;
+  const __m256i zero = _mm256_setzero_si256();
+
+  unsigned mask = _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)p), zero));
+  mask >>= offset;
+  if (mask != 0) {
+    return __builtin_ctz(mask);
+  }
+
+  // Check single blocks up to a 128 byte boundary. From there on, four
+  // blocks are checked per iteration. All of them lie in the same 128 byte
+  // block and thus in the same page.
+  for (p += 32; (uintptr_t)p & 127; p += 32) {
+    mask = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)p), zero));
+    if (mask != 0) {
+      return p - s + __builtin_ctz(mask);
+    }
+  }
+  for (;; p += 128) {
+    __m256i a = _mm256_load_si256((const __m256i *)p);
+    __m256i b = _mm256_load_si256((const __m256i *)(p + 32));
+    __m256i c = _mm256_load_si256((const __m256i *)(p + 64));
+    __m256i d = _mm256_load_si256((const __m256i *)(p + 96));
+    // The minimum of the blocks has a zero byte if any of them has one.
+    __m256i min = _mm256_min_epu8(_mm256_min_epu8(a, b), _mm256_min_epu8(c, d));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(min, zero)) != 0) {
+      uint64_t lo = _zeroMaskAvx2(a, b, zero);
+      if (lo != 0) {
+        return p - s + __builtin_ctzll(lo);
+      }
+      uint64_t hi = _zeroMaskAvx2(c, d, zero);
+      return p + 64 - s + __builtin_ctzll(hi);
+    }
+  }
+}
+
+/*
+ * The copy functions move whole vectors with unaligned loads and stores. The
+ * last vector may overlap the previous one instead of falling back to single
+ * bytes for the tail.
  */
-size_t stringlength(const char *s) {
-  size_t count = 0;
-  while (*s) {
-    count++;
-    s++;
+static void _copySse2(char *dst, const char *src, size_t n) {
+  if (n < 16) {
+    _copyScalar(dst, src, n);
+    return;
   }
-  return count;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_loadu_si128((const __m128i *)(src + i)));
+  }
+  if (i < n) {
+    _mm_storeu_si128((__m128i *)(dst + n - 16),
+                     _mm_loadu_si128((const __m128i *)(src + n - 16)));
+  }
+}
+
+__attribute__((target("avx2"))) static void _copyAvx2(char *dst,
+                                                      const char *src,
+                                                      size_t n) {
+  if (n < 32) {
+    _copySse2(dst, src, n);
+    return;
+  }
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+    _mm256_storeu_si256((__m256i *)(dst + i), a);
+    _mm256_storeu_si256((__m256i *)(dst + i + 32), b);
+  }
+  if (i + 32 <= n) {
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_loadu_si256((const __m256i *)(src + i)));
+    i += 32;
+  }
+  if (i < n) {
+    _mm256_storeu_si256((__m256i *)(dst + n - 32),
+                        _mm256_loadu_si256((const __m256i *)(src + n - 32)));
+  }
+}
+
+__attribute__((no_sanitize_address)) static uint64_t
+_splitMaskSse2(const char *block, int from, char delimiter) {
+  (void)from;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i delim = _mm_set1_epi8(delimiter);
+  uint64_t mask = 0;
+
+  for (int i = 0; i < SPLIT_BLOCK; i += 16) {
+    __m128i v = _mm_load_si128((const __m128i *)(block + i));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, delim), _mm_cmpeq_epi8(v, zero));
+    mask |= (uint64_t)(unsigned)_mm_movemask_epi8(hit) << i;
+  }
+  return mask;
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) static uint64_t
+_splitMaskAvx2(const char *block, int from, char delimiter) {
+  (void)from;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i delim = _mm256_set1_epi8(delimiter);
+
+  __m256i a = _mm256_load_si256((const __m256i *)block);
+  __m256i b = _mm256_load_si256((const __m256i *)(block + 32));
+  uint64_t lo = (unsigned)_mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_cmpeq_epi8(a, delim), _mm256_cmpeq_epi8(a, zero)));
+  uint64_t hi = (unsigned)_mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_cmpeq_epi8(b, delim), _mm256_cmpeq_epi8(b, zero)));
+  return lo | (hi << 32);
+}
+#endif
+
+/*
+ * Picks the widest implementation the CPU supports. Racing callers all pick
+ * the same functions, so no locking is needed.
+ */
+static void _selectImpl() {
+#if STRINGS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    _length = _lengthAvx2;
+    _copy = _copyAvx2;
+    _splitMask = _splitMaskAvx2;
+  } else {
+    _length = _lengthSse2;
+    _copy = _copySse2;
+    _splitMask = _splitMaskSse2;
+  }
+#else
+  _length = _lengthScalar;
+  _copy = _copyScalar;
+  _splitMask = _splitMaskScalar;
+#endif
+}
+
+static size_t _lengthSelect(const char *s) {
+  _selectImpl();
+  return _length(s);
+}
+
+static void _copySelect(char *dst, const char *src, size_t n) {
+  _selectImpl();
+  _copy(dst, src, n);
+}
+
+static uint64_t _splitMaskSelect(const char *block, int from, char delimiter) {
+  _selectImpl();
+  return _splitMask(block, from, delimiter);
 }
 
+/**
+ * Returns the length of string s without counting the terminating null byte.
+ */
+size_t stringlength(const char *s) { return _length(s); }
+
 /**
  * Returns a new null byte terminated string that is the result of appending
  * string s2 to s1. The caller is responsible to free the returned string.
  * Returns NULL on any error.
  */
 char *stringconcat(const char *s1, const char *s2) {
-  char *ptr =
-      (char *)malloc(sizeof(char) * (stringlength(s1) + stringlength(s2) + 1));
-  char *ret = ptr;
-  if (ptr == NULL) {
+  size_t len1 = stringlength(s1);
+  size_t len2 = stringlength(s2);
+  char *ret = (char *)malloc(sizeof(char) * (len1 + len2 + 1));
+  if (ret == NULL) {
     return NULL;
   }
-  while (*s1) {
-    *ptr = *s1;
-    s1++;
-    ptr++;
-  }
-  while (*s2) {
-    *ptr = *s2;
-    s2++;
-    ptr++;
-  }
-  *ptr = '\0';
+  _copy(ret, s1, len1);
+  _copy(ret + len1, s2, len2);
+  ret[len1 + len2] = '\0';
   return ret;
 }
 
@@ -45,36 +300,33 @@ char *stringconcat(const char *s1, const char *s2) {
  * Returns NULL on any error.
  */
 char **stringsplit(const char *toSplit, char delimiter) {
-  const char *ptr = toSplit;
-  size_t num = 1, len = 0;
+  size_t len = stringlength(toSplit);
+  size_t num = 1;
 
   // get number of arrays
-  while (*ptr) {
-    len++;
-    if (*ptr == delimiter) {
+  for (size_t i = 0; i < len; i++) {
+    if (toSplit[i] == delimiter) {
       num++;
     }
-    ptr++;
   }
   char *str = malloc((len + 1) * sizeof(char));
-  char **ret = (char **)malloc(sizeof(char *) * num);
+  char **ret = (char **)malloc(sizeof(char *) * (num + 1));
   if (ret == NULL || str == NULL) {
+    free(str);
+    free(ret);
     return NULL;
   }
+
+  // Copy the whole string at once and cut it at the delimiters.
+  _copy(str, toSplit, len + 1);
   char **p = ret;
-  *p = str;
-  p++;
-  ptr = toSplit;
-  while (*ptr) {
-    if (*ptr == delimiter) {
-      *str++ = '\0';
-      *p++ = str;
-    } else {
-      *str++ = *ptr;
+  *p++ = str;
+  for (size_t i = 0; i < len; i++) {
+    if (str[i] == delimiter) {
+      str[i] = '\0';
+      *p++ = str + i + 1;
     }
-    ptr++;
   }
-  *str = '\0';
   *p = NULL;
   return ret;
 }
@@ -86,3 +338,279 @@ void stringsplit_free(char **parts) {
   free(*parts);
   free(parts);
 }
+
+/**
+ * Prepares it to iterate over the substrings of toSplit between occurrences
+ * of the delimiter. The iterator does not allocate any memory. toSplit must
+ * stay unchanged while the iterator is in use.
+ */
+void stringsplit_iter_init(StringSplitIterator *it, const char *toSplit,
+                           char delimiter) {
+  uintptr_t offset = (uintptr_t)toSplit % SPLIT_BLOCK;
+
+  it->start = toSplit;
+  it->block = toSplit - offset;
+  it->delimiter = delimiter;
+  it->done = 0;
+  // Ignore hits in front of the string.
+  it->mask =
+      _splitMask(it->block, offset, delimiter) & (~(uint64_t)0 << offset);
+}
+
+/**
+ * Stores the next substring to slice.
+ * Returns 1 if there was another substring, 0 after the last one.
+ */
+int stringsplit_iter_next(StringSplitIterator *it, StringSlice *slice) {
+  if (it->done) {
+    return 0;
+  }
+  while (it->mask == 0) {
+    it->block += SPLIT_BLOCK;
+    it->mask = _splitMask(it->block, 0, it->delimiter);
+  }
+
+  const char *end = it->block + __builtin_ctzll(it->mask);
+  it->mask &= it->mask - 1;
+
+  slice->ptr = it->start;
+  slice->length = end - it->start;
+  if (*end == '\0') {
+    it->done = 1;
+  } else {
+    it->start = end + 1;
+  }
+  return 1;
+}
+
+/**
+ * Splits string toSplit at every occurrence of the delimiter without copying
+ * it. Returns an array of *count slices that point into toSplit. The caller
+ * is responsible to free the returned array, toSplit must outlive it.
+ * Returns NULL on any error.
+ */
+StringSlice *stringsplit_slices(const char *toSplit, char delimiter,
+                                size_t *count) {
+  size_t capacity = 16, num = 0;
+  StringSlice *ret = malloc(capacity * sizeof(StringSlice));
+  if (ret == NULL) {
+    return NULL;
+  }
+
+  // A single pass over the string, growing the array as needed.
+  StringSplitIterator it;
+  stringsplit_iter_init(&it, toSplit, delimiter);
+  while (stringsplit_iter_next(&it, &ret[num])) {
+    if (++num == capacity) {
+      capacity *= 2;
+      StringSlice *grown = realloc(ret, capacity * sizeof(StringSlice));
+      if (grown == NULL) {
+        free(ret);
+        return NULL;
+      }
+      ret = grown;
+    }
+  }
+  *count = num;
+  return ret;
+}
+
+/**
+ * Prepares an empty builder with room for capacity bytes.
+ * Returns -1 on error, 0 otherwise.
+ */
+int stringbuilder_init(StringBuilder *sb, size_t capacity) {
+  if (capacity < BUILDER_MIN_CAPACITY) {
+    capacity = BUILDER_MIN_CAPACITY;
+  }
+  sb->data = malloc(capacity);
+  sb->length = 0;
+  sb->capacity = sb->data ? capacity : 0;
+  return sb->data ? 0 : -1;
+}
+
+/*
+ * Makes room for at least extra more bytes plus the null byte.
+ * Returns -1 on error, 0 otherwise.
+ */
+static int _builderReserve(StringBuilder *sb, size_t extra) {
+  size_t needed = sb->length + extra + 1;
+  if (needed < extra) {
+    return -1;
+  }
+  if (needed <= sb->capacity) {
+    return 0;
+  }
+
+  size_t capacity = sb->capacity ? sb->capacity : BUILDER_MIN_CAPACITY;
+  while (capacity < needed) {
+    if (capacity > SIZE_MAX / 2) {
+      capacity = needed;
+      break;
+    }
+    capacity *= 2;
+  }
+  char *data = realloc(sb->data, capacity);
+  if (data == NULL) {
+    return -1;
+  }
+  sb->data = data;
+  sb->capacity = capacity;
+  return 0;
+}
+
+/**
+ * Appends the first length bytes of s. s does not need to be null byte
+ * terminated.
+ * Returns -1 on error, 0 otherwise.
+ */
+int stringbuilder_append_n(StringBuilder *sb, const char *s, size_t length) {
+  if (_builderReserve(sb, length) != 0) {
+    return -1;
+  }
+  _copy(sb->data + sb->length, s, length);
+  sb->length += length;
+  return 0;
+}
+
+/**
+ * Appends the null byte terminated string s.
+ * Returns -1 on error, 0 otherwise.
+ */
+int stringbuilder_append(StringBuilder *sb, const char *s) {
+  return stringbuilder_append_n(sb, s, stringlength(s));
+}
+
+/**
+ * Returns the built null byte terminated string and leaves the builder
+ * empty. The caller is responsible to free the returned string.
+ * Returns NULL on any error.
+ */
+char *stringbuilder_finalize(StringBuilder *sb) {
+  if (_builderReserve(sb, 0) != 0) {
+    return NULL;
+  }
+  char *ret = sb->data;
+  ret[sb->length] = '\0';
+
+  sb->data = NULL;
+  sb->length = 0;
+  sb->capacity = 0;
+  return ret;
+}
+
+/**
+ * Frees the memory of a builder that was not finalized.
+ */
+void stringbuilder_free(StringBuilder *sb) {
+  free(sb->data);
+  sb->data = NULL;
+  sb->length = 0;
+  sb->capacity = 0;
+}
+
+struct _RopeChunk {
+  RopeChunk *next;
+  size_t length;
+  size_t capacity;
+  char data[];
+};
+
+/**
+ * Prepares an empty rope.
+ */
+void stringrope_init(StringRope *rope) {
+  rope->head = NULL;
+  rope->tail = NULL;
+  rope->length = 0;
+}
+
+/**
+ * Appends the first length bytes of s.
+ * Returns -1 on error, 0 otherwise.
+ */
+int stringrope_append_n(StringRope *rope, const char *s, size_t length) {
+  RopeChunk *tail = rope->tail;
+
+  // Fill up the last chunk first.
+  if (tail != NULL) {
+    size_t room = tail->capacity - tail->length;
+    size_t n = (length < room) ? length : room;
+    _copy(tail->data + tail->length, s, n);
+    tail->length += n;
+    rope->length += n;
+    s += n;
+    length -= n;
+  }
+  if (length == 0) {
+    return 0;
+  }
+
+  size_t capacity = (length > ROPE_CHUNK_SIZE) ? length : ROPE_CHUNK_SIZE;
+  RopeChunk *chunk = malloc(sizeof(RopeChunk) + capacity);
+  if (chunk == NULL) {
+    return -1;
+  }
+  chunk->next = NULL;
+  chunk->length = length;
+  chunk->capacity = capacity;
+  _copy(chunk->data, s, length);
+
+  if (tail != NULL) {
+    tail->next = chunk;
+  } else {
+    rope->head = chunk;
+  }
+  rope->tail = chunk;
+  rope->length += length;
+  return 0;
+}
+
+/**
+ * Moves all of other to the end of rope. other is left empty.
+ */
+void stringrope_join(StringRope *rope, StringRope *other) {
+  if (other->head == NULL) {
+    return;
+  }
+  if (rope->tail != NULL) {
+    rope->tail->next = other->head;
+  } else {
+    rope->head = other->head;
+  }
+  rope->tail = other->tail;
+  rope->length += other->length;
+  stringrope_init(other);
+}
+
+/**
+ * Returns the content of the rope as a new null byte terminated string. The
+ * caller is responsible to free the returned string.
+ * Returns NULL on any error.
+ */
+char *stringrope_flatten(const StringRope *rope) {
+  char *ret = malloc(rope->length + 1);
+  if (ret == NULL) {
+    return NULL;
+  }
+  char *ptr = ret;
+  for (RopeChunk *chunk = rope->head; chunk != NULL; chunk = chunk->next) {
+    _copy(ptr, chunk->data, chunk->length);
+    ptr += chunk->length;
+  }
+  *ptr = '\0';
+  return ret;
+}
+
+/**
+ * Frees all chunks of the rope and leaves it empty.
+ */
+void stringrope_free(StringRope *rope) {
+  RopeChunk *chunk = rope->head;
+  while (chunk != NULL) {
+    RopeChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  stringrope_init(rope);
+}
@@ -1,6 +1,7 @@
 #ifndef STRINGS_H
 #define STRINGS_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -33,4 +34,129 @@ char **stringsplit(const char *toSplit, char delimiter);
  */
 void stringsplit_free(char **parts);
 
+/**
+ * A substring that points into another string. It is not null byte
+ * terminated.
+ */
+typedef struct {
+  const char *ptr;
+  size_t length;
+} StringSlice;
+
+/**
+ * State of a split in progress, see stringsplit_iter_init().
+ */
+typedef struct {
+  const char *start;
+  const char *block;
+  uint64_t mask;
+  char delimiter;
+  int done;
+} StringSplitIterator;
+
+/**
+ * Prepares it to iterate over the substrings of toSplit between occurrences
+ * of the delimiter. The iterator does not allocate any memory. toSplit must
+ * stay unchanged while the iterator is in use.
+ */
+void stringsplit_iter_init(StringSplitIterator *it, const char *toSplit,
+                           char delimiter);
+
+/**
+ * Stores the next substring to slice.
+ * Returns 1 if there was another substring, 0 after the last one.
+ */
+int stringsplit_iter_next(StringSplitIterator *it, StringSlice *slice);
+
+/**
+ * Splits string toSplit at every occurrence of the delimiter without copying
+ * it. Returns an array of *count slices that point into toSplit. The caller
+ * is responsible to free the returned array, toSplit must outlive it.
+ * Returns NULL on any error.
+ */
+StringSlice *stringsplit_slices(const char *toSplit, char delimiter,
+                                size_t *count);
+
+/**
+ * A string that grows in place. Appending n bytes costs amortized O(n),
+ * because the buffer doubles whenever it is full.
+ */
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} StringBuilder;
+
+/**
+ * Prepares an empty builder with room for capacity bytes.
+ * Returns -1 on error, 0 otherwise.
+ */
+int stringbuilder_init(StringBuilder *sb, size_t capacity);
+
+/**
+ * Appends the null byte terminated string s.
+ * Returns -1 on error, 0 otherwise.
+ */
+int stringbuilder_append(StringBuilder *sb, const char *s);
+
+/**
+ * Appends the first length bytes of s. s does not need to be null byte
+ * terminated.
+ * Returns -1 on error, 0 otherwise.
+ */
+int stringbuilder_append_n(StringBuilder *sb, const char *s, size_t length);
+
+/**
+ * Returns the built null byte terminated string and leaves the builder
+ * empty. The caller is responsible to free the returned string.
+ * Returns NULL on any error.
+ */
+char *stringbuilder_finalize(StringBuilder *sb);
+
+/**
+ * Frees the memory of a builder that was not finalized.
+ */
+void stringbuilder_free(StringBuilder *sb);
+
+typedef struct _RopeChunk RopeChunk;
+
+/**
+ * A string kept in a list of chunks. Appending never moves the bytes that
+ * are already stored and joining two ropes takes O(1). Meant for documents
+ * that are too large to be copied around while they are built.
+ */
+typedef struct {
+  RopeChunk *head;
+  RopeChunk *tail;
+  size_t length;
+} StringRope;
+
+/**
+ * Prepares an empty rope.
+ */
+void stringrope_init(StringRope *rope);
+
+/**
+ * Appends the first length bytes of s.
+ * Returns -1 on error, 0 otherwise.
+ */
+int stringrope_append_n(StringRope *rope, const char *s, size_t length);
+
+/**
+ * Moves all of other to the end of rope. other is left empty.
+ */
+void stringrope_join(StringRope *rope, StringRope *other);
+
+/**
+ * Returns the content of the rope as a new null byte terminated string. The
+ * caller is responsible to free the returned string.
+ * Returns NULL on any error.
+ */
+char *stringrope_flatten(const StringRope *rope);
+
+/**
+ * Frees all chunks of the rope and leaves it empty.
+ */
+void stringrope_free(StringRope *rope);
+
 #endif
@@ -0,0 +1,174 @@
+#include "mmu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Replays a synthetic address trace through TLBs of different shapes. Build
+ * with:
+ *   gcc -O2 -o bench bench.c mmu.c
+ */
+
+#define TRACE_LENGTH (4 * 1024 * 1024)
+
+/*
+ * Number of distinct addresses in the trace. Most accesses go to a small hot
+ * subset of them.
+ */
+#define WORKING_SET 2048
+
+static SegmentTable _table;
+static uint32_t _trace[TRACE_LENGTH];
+static volatile uint32_t _sink;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void makeTrace(void)
+{
+    for (unsigned i = 0; i < SEGMENT_COUNT; i++) {
+        _table.segments[i].base = i * 0x100000;
+        _table.segments[i].length = 0x100000;
+    }
+    srand(1);
+    for (int i = 0; i < TRACE_LENGTH; i++) {
+        // Cubing a uniform number skews the accesses towards low ranks.
+        double u = rand() / (double)RAND_MAX;
+        uint32_t rank = (uint32_t)(u * u * u * WORKING_SET);
+        uint32_t segment = rank % SEGMENT_COUNT;
+        _trace[i] = (segment << OFFSET_BITS) | (rank * 64);
+    }
+}
+
+static void replay(const char *name, unsigned entries, unsigned ways, TLBPolicy policy)
+{
+    TLBConfig config = {.entries = entries, .ways = ways, .policy = policy};
+    if (configureTLB(&config) != 0) {
+        printf("%-8s %5u entries %2u-way: invalid configuration\n", name, entries, ways);
+        return;
+    }
+
+    double start = now_s();
+    for (int i = 0; i < TRACE_LENGTH; i++) {
+        uint32_t address = _trace[i];
+        if (translateTLB(&address) != 0) {
+            address = _trace[i];
+            if (translateSegmentTable(&address) == 0) {
+                addToTLB(_trace[i], address);
+            }
+        }
+        _sink = address;
+    }
+    double elapsed = now_s() - start;
+
+    TLBStats stats;
+    getTLBStats(&stats);
+    printf("%-8s %5u entries %2u-way: hit rate %6.2f%%  %6.2f ns/translation\n",
+           name, entries, ways, 100.0 * stats.hits / (stats.hits + stats.misses),
+           elapsed * 1e9 / TRACE_LENGTH);
+}
+
+static uint32_t _physical[TRACE_LENGTH];
+static uint64_t _faults[(TRACE_LENGTH + 63) / 64];
+
+static void replayBatch(void)
+{
+    double start = now_s();
+    for (int i = 0; i < TRACE_LENGTH; i++) {
+        uint32_t address = _trace[i];
+        _physical[i] = (translateSegmentTable(&address) == 0) ? address : _trace[i];
+    }
+    double single = now_s() - start;
+
+    size_t numFaults;
+    start = now_s();
+    translateSegmentTableBatch(_trace, _physical, TRACE_LENGTH, _faults, &numFaults);
+    double batch = now_s() - start;
+
+    printf("\nSegment table without TLB, %d addresses\n", TRACE_LENGTH);
+    printf("  translateSegmentTable:      %6.3f ns/translation\n", single * 1e9 / TRACE_LENGTH);
+    printf("  translateSegmentTableBatch: %6.3f ns/translation\n", batch * 1e9 / TRACE_LENGTH);
+}
+
+/*
+ * Interleaved trace: PROCESSES address spaces take turns, each running for
+ * SLICE translations over its own working set of PROCESS_PAGES addresses.
+ */
+#define PROCESSES 4
+#define SLICE 2000
+#define PROCESS_PAGES 96
+
+static SegmentTable _processTables[PROCESSES];
+
+static void replayProcesses(const char *name, int useAsids)
+{
+    TLBConfig config = {.entries = 512, .ways = 8, .policy = TLB_POLICY_LRU};
+    configureTLB(&config);
+
+    srand(2);
+    uint64_t translations = 0;
+    double start = now_s();
+    for (int round = 0; round < TRACE_LENGTH / (PROCESSES * SLICE); round++) {
+        for (int p = 0; p < PROCESSES; p++) {
+            if (useAsids) {
+                setSegmentTableAsid(&_processTables[p], p + 1);
+            } else {
+                setSegmentTable(&_processTables[p]);
+            }
+            for (int i = 0; i < SLICE; i++) {
+                uint32_t virtual = (rand() % PROCESS_PAGES) * 64;
+                uint32_t address = virtual;
+                if (translateTLB(&address) != 0) {
+                    address = virtual;
+                    if (translateSegmentTable(&address) == 0) {
+                        addToTLB(virtual, address);
+                    }
+                }
+                _sink = address;
+                translations++;
+            }
+        }
+    }
+    double elapsed = now_s() - start;
+
+    TLBStats stats;
+    getTLBStats(&stats);
+    printf("%-24s hit rate %6.2f%%  %6.2f ns/translation\n", name,
+           100.0 * stats.hits / (stats.hits + stats.misses), elapsed * 1e9 / translations);
+}
+
+int main()
+{
+    makeTrace();
+    setSegmentTable(&_table);
+
+    replay("LRU", 4, 4, TLB_POLICY_LRU);
+    replay("LRU", 32, 32, TLB_POLICY_LRU);
+
+    TLBPolicy policies[] = {TLB_POLICY_LRU, TLB_POLICY_PLRU, TLB_POLICY_RANDOM, TLB_POLICY_CLOCK};
+    const char *names[] = {"LRU", "PLRU", "random", "clock"};
+    for (int p = 0; p < 4; p++) {
+        replay(names[p], 64, 4, policies[p]);
+        replay(names[p], 512, 8, policies[p]);
+        replay(names[p], 1024, 16, policies[p]);
+    }
+
+    replayBatch();
+
+    for (int p = 0; p < PROCESSES; p++) {
+        for (unsigned i = 0; i < SEGMENT_COUNT; i++) {
+            _processTables[p].segments[i].base = (p * SEGMENT_COUNT + i) * 0x100000;
+            _processTables[p].segments[i].length = 0x100000;
+        }
+    }
+    printf("\n%d processes, %d translations per time slice, 512 entries 8-way\n",
+           PROCESSES, SLICE);
+    replayProcesses("flush on switch", 0);
+    replayProcesses("ASID tagged", 1);
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include "testlib.h"
 #include "mmu.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 static SegmentTable _table = {
     .segments = {
@@ -50,6 +51,65 @@ static uint32_t translateAddress(uint32_t virtual)
     }
 }
 
+// Returns 1 if the address is currently cached in the TLB, 0 otherwise.
+static int inTLB(uint32_t virtual)
+{
+    uint32_t address = virtual;
+    return translateTLB(&address) == 0;
+}
+
+// Fills a fresh 4-way set with A..D, uses A again and adds E.
+// Returns a bit mask of which of A..E are still cached.
+static int evictionPattern(TLBPolicy policy)
+{
+    TLBConfig config = {.entries = 4, .ways = 4, .policy = policy};
+    configureTLB(&config);
+    for (uint32_t i = 0; i < 4; i++) {
+        addToTLB(i, i);
+    }
+    inTLB(0);
+    addToTLB(4, 4);
+
+    int cached = 0;
+    for (uint32_t i = 0; i < 5; i++) {
+        cached |= inTLB(i) << i;
+    }
+    return cached;
+}
+
+#define BATCH_SIZE 1003
+
+// Compares translateSegmentTableBatch() with translateSegmentTable() for
+// random addresses. Returns the number of mismatches.
+static int checkBatch(size_t *numFaults)
+{
+    static uint32_t virtual[BATCH_SIZE], physical[BATCH_SIZE];
+    static uint64_t faults[(BATCH_SIZE + 63) / 64];
+    int errors = 0;
+
+    srand(3);
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        virtual[i] = ((uint32_t)(rand() % SEGMENT_COUNT) << OFFSET_BITS) | (rand() % 0x120);
+    }
+    if (translateSegmentTableBatch(virtual, physical, BATCH_SIZE, faults, numFaults) != 0) {
+        return -1;
+    }
+
+    size_t expectedFaults = 0;
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        uint32_t address = virtual[i];
+        int fault = translateSegmentTable(&address) != 0;
+        expectedFaults += fault;
+        if ((fault != (int)((faults[i / 64] >> (i % 64)) & 1)) || (physical[i] != address)) {
+            errors++;
+        }
+    }
+    if (*numFaults != expectedFaults) {
+        errors++;
+    }
+    return errors;
+}
+
 int main()
 {
     test_start("mmu.c");
@@ -86,5 +146,69 @@ int main()
     test_equals_int(translateAddress(0x00000075), 0x75, "virtual address 0x00000075 translates correctly (with TLB)");
     test_equals_int(translateAddress(0x00000017), 0x17, "virtual address 0x00000017 translates correctly (with TLB)");
 
+    size_t numFaults = 0;
+    test_equals_int(checkBatch(&numFaults), 0, "translateSegmentTableBatch matches translateSegmentTable");
+    test_assert(numFaults > 0 && numFaults < BATCH_SIZE, "the batch contains valid and invalid addresses");
+    uint32_t one = 0x20000010;
+    uint64_t fault;
+    test_assert(translateSegmentTableBatch(&one, &one, 1, &fault, NULL) == 0 && one == 0x90 && fault == 0,
+                "translateSegmentTableBatch translates in place");
+    test_equals_int(translateSegmentTableBatch(NULL, &one, 1, &fault, NULL), -1,
+                    "translateSegmentTableBatch rejects NULL");
+
+    TLBStats stats;
+    getTLBStats(&stats);
+    test_equals_int64(stats.hits, 5, "the default TLB hits 5 times");
+    test_equals_int64(stats.misses, 13, "the default TLB misses 13 times");
+
+    TLBConfig bad = {.entries = 48, .ways = 4, .policy = TLB_POLICY_LRU};
+    test_equals_int(configureTLB(&bad), -1, "configureTLB rejects sizes that are not a power of two");
+    bad = (TLBConfig){.entries = 4, .ways = 8, .policy = TLB_POLICY_LRU};
+    test_equals_int(configureTLB(&bad), -1, "configureTLB rejects more ways than entries");
+
+    // A (bit 0) was used last, so LRU evicts B.
+    test_equals_int(evictionPattern(TLB_POLICY_LRU), 0x1d, "LRU evicts the least recently used entry");
+    // The tree points to the pair C, D after A was used, and to C within it.
+    test_equals_int(evictionPattern(TLB_POLICY_PLRU), 0x1b, "PLRU evicts the entry the tree points to");
+    // All entries are referenced, so the hand clears them and comes back to A.
+    test_equals_int(evictionPattern(TLB_POLICY_CLOCK), 0x1e, "clock evicts A after one round");
+    int cached = evictionPattern(TLB_POLICY_RANDOM);
+    test_assert((cached & 0x10) && (__builtin_popcount(cached) == 4), "random evicts exactly one old entry");
+    getTLBStats(&stats);
+    test_equals_int64(stats.evictions, 1, "addToTLB counts the eviction");
+
+    TLBConfig large = {.entries = 64, .ways = 4, .policy = TLB_POLICY_LRU};
+    test_equals_int(configureTLB(&large), 0, "configureTLB accepts 64 entries, 4-way");
+    for (uint32_t i = 0; i < 32; i++) {
+        addToTLB(i * 4, i);
+    }
+    int hits = 0;
+    for (uint32_t i = 0; i < 32; i++) {
+        hits += inTLB(i * 4);
+    }
+    getTLBStats(&stats);
+    test_assert(hits >= 24, "most of 32 addresses stay cached in a 64 entry TLB");
+    test_equals_int64(stats.hits + stats.misses, 32, "translateTLB counts every lookup");
+
+    // Two address spaces that map the same virtual address differently.
+    static SegmentTable otherTable = {.segments = {{.base = 0x5000, .length = 0x80}}};
+    TLBConfig asidConfig = {.entries = 64, .ways = 4, .policy = TLB_POLICY_LRU};
+    configureTLB(&asidConfig);
+    setSegmentTableAsid(&_table, 1);
+    test_equals_int(translateAddress(0x00000010), 0x10, "address space 1 maps 0x10 to 0x10");
+    setSegmentTableAsid(&otherTable, 2);
+    test_assert(!inTLB(0x00000010), "the translation of address space 1 does not match in address space 2");
+    test_equals_int(translateAddress(0x00000010), 0x5010, "address space 2 maps 0x10 to 0x5010");
+    setSegmentTableAsid(&_table, 1);
+    uint32_t address = 0x10;
+    test_assert(translateTLB(&address) == 0 && address == 0x10, "switching back to address space 1 keeps its translation cached");
+    invalidateTLBAsid(1);
+    test_assert(!inTLB(0x00000010), "invalidateTLBAsid removes the translations of address space 1");
+    setSegmentTableAsid(&otherTable, 2);
+    address = 0x10;
+    test_assert(translateTLB(&address) == 0 && address == 0x5010, "invalidateTLBAsid keeps the translations of address space 2");
+    setSegmentTable(&_table);
+    test_assert(!inTLB(0x00000010), "setSegmentTable flushes the TLB");
+
     return test_end();
 }
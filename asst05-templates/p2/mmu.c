@@ -2,19 +2,46 @@
 #include <string.h> // only for memset.
 #include <assert.h>
 
+#if defined(__x86_64__) && (SEGMENT_COUNT == 8)
+#include <immintrin.h>
+// With 8 segments, the whole segment table fits into two AVX2 registers.
+#define BATCH_AVX2 1
+#else
+#define BATCH_AVX2 0
+#endif
+
 static SegmentTable *_table = NULL;
 
+// Address space of the current segment table. TLB entries of other address
+// spaces stay cached, but never match.
+static uint16_t _asid = 0;
+
 typedef struct {
     uint32_t virtual;
     uint32_t physical;
-    // Last access time.
-    uint32_t lastAccess;
-    int valid;
+    uint16_t asid;
+    // Last access time (LRU).
+    uint64_t lastAccess;
+    // Used since the clock hand last passed (clock).
+    uint8_t referenced;
+    uint8_t valid;
 } TLBEntry;
 
-// Counter for the LRU strategy. We assume that this will never overflow.
-static uint32_t _accessCounter = 0;
-static TLBEntry _tlb[TLB_SIZE];
+// Counter for the LRU strategy. 64 bits will not overflow in practice.
+static uint64_t _accessCounter = 0;
+static TLBEntry _tlb[TLB_MAX_ENTRIES];
+
+// Per-set replacement state: the tree bits for PLRU and the hand for clock.
+static uint32_t _plruBits[TLB_MAX_ENTRIES];
+static uint32_t _clockHand[TLB_MAX_ENTRIES];
+
+static TLBConfig _config = {
+    .entries = TLB_SIZE, .ways = TLB_SIZE, .policy = TLB_POLICY_LRU
+};
+// log2 of the number of sets.
+static unsigned _setBits = 0;
+static uint32_t _randomState = 0x12345678;
+static TLBStats _stats;
 
 // All bits except the first three bits.
 // Since the segment has 3 bits, this is 0x1ffffff
@@ -23,9 +50,27 @@ static TLBEntry _tlb[TLB_SIZE];
 void setSegmentTable(SegmentTable *newTable)
 {
     _table = newTable;
+    _asid = 0;
     flushTLB();
 }
 
+void setSegmentTableAsid(SegmentTable *newTable, uint16_t asid)
+{
+    // No flush: the entries of the new address space may still be cached
+    // from the last time it ran.
+    _table = newTable;
+    _asid = asid;
+}
+
+void invalidateTLBAsid(uint16_t asid)
+{
+    for (unsigned i = 0; i < _config.entries; i++) {
+        if (_tlb[i].asid == asid) {
+            _tlb[i].valid = 0;
+        }
+    }
+}
+
 int translateSegmentTable(uint32_t *address)
 {
     if ((_table == NULL) || (address == NULL)) {
@@ -54,30 +99,262 @@ int translateSegmentTable(uint32_t *address)
     return -1;
 }
 
+// Translates virtual[first..count) one address at a time.
+static size_t translateBatchScalar(const uint32_t *virtual, uint32_t *physical,
+                                   size_t first, size_t count, uint64_t *faults)
+{
+    size_t numFaults = 0;
+    for (size_t i = first; i < count; i++) {
+        uint32_t address = virtual[i];
+        const Segment *segment = &_table->segments[address >> OFFSET_BITS];
+        uint32_t offset = address & OFFSET_MASK;
+        if (offset < segment->length) {
+            physical[i] = segment->base + offset;
+        } else {
+            physical[i] = address;
+            faults[i / 64] |= (uint64_t)1 << (i % 64);
+            numFaults++;
+        }
+    }
+    return numFaults;
+}
+
+#if BATCH_AVX2
+// Translates 8 addresses per iteration: the segment indices select the base
+// and length of each lane from registers holding the whole table. Returns the
+// number of faults, *done is set to the number of translated addresses.
+__attribute__((target("avx2")))
+static size_t translateBatchAvx2(const uint32_t *virtual, uint32_t *physical,
+                                 size_t count, uint64_t *faults, size_t *done)
+{
+    uint32_t bases[SEGMENT_COUNT], lengths[SEGMENT_COUNT];
+    for (unsigned i = 0; i < SEGMENT_COUNT; i++) {
+        bases[i] = _table->segments[i].base;
+        lengths[i] = _table->segments[i].length;
+    }
+    const __m256i base = _mm256_loadu_si256((const __m256i *)bases);
+    const __m256i length = _mm256_loadu_si256((const __m256i *)lengths);
+    const __m256i offsetMask = _mm256_set1_epi32(OFFSET_MASK);
+
+    size_t numFaults = 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i address = _mm256_loadu_si256((const __m256i *)(virtual + i));
+        __m256i segment = _mm256_srli_epi32(address, OFFSET_BITS);
+        __m256i offset = _mm256_and_si256(address, offsetMask);
+
+        __m256i segmentBase = _mm256_permutevar8x32_epi32(base, segment);
+        __m256i segmentLength = _mm256_permutevar8x32_epi32(length, segment);
+
+        // Unsigned offset >= length, i.e., max(offset, length) == offset.
+        __m256i fault = _mm256_cmpeq_epi32(
+            _mm256_max_epu32(offset, segmentLength), offset);
+        __m256i translated = _mm256_add_epi32(segmentBase, offset);
+        _mm256_storeu_si256((__m256i *)(physical + i),
+                            _mm256_blendv_epi8(translated, address, fault));
+
+        unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(fault));
+        // i is a multiple of 8, so the 8 bits never straddle two words.
+        faults[i / 64] |= (uint64_t)mask << (i % 64);
+        numFaults += __builtin_popcount(mask);
+    }
+    *done = i;
+    return numFaults;
+}
+#endif
+
+int translateSegmentTableBatch(const uint32_t *virtual, uint32_t *physical,
+                               size_t count, uint64_t *faults,
+                               size_t *numFaults)
+{
+    if ((_table == NULL) || (virtual == NULL) || (physical == NULL) ||
+        (faults == NULL)) {
+        return -1;
+    }
+
+    memset(faults, 0, (count + 63) / 64 * sizeof(uint64_t));
+
+    size_t done = 0, faulted = 0;
+#if BATCH_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        faulted = translateBatchAvx2(virtual, physical, count, faults, &done);
+    }
+#endif
+    faulted += translateBatchScalar(virtual, physical, done, count, faults);
+
+    if (numFaults != NULL) {
+        *numFaults = faulted;
+    }
+    return 0;
+}
+
+static int isPowerOfTwo(unsigned x)
+{
+    return (x != 0) && ((x & (x - 1)) == 0);
+}
+
+int configureTLB(const TLBConfig *config)
+{
+    if ((config == NULL) || !isPowerOfTwo(config->entries) ||
+        !isPowerOfTwo(config->ways) || (config->entries > TLB_MAX_ENTRIES) ||
+        (config->ways > TLB_MAX_WAYS) || (config->ways > config->entries) ||
+        (config->policy > TLB_POLICY_CLOCK)) {
+        return -1;
+    }
+
+    _config = *config;
+    _setBits = __builtin_ctz(config->entries / config->ways);
+    flushTLB();
+    resetTLBStats();
+    return 0;
+}
+
+void getTLBStats(TLBStats *stats)
+{
+    *stats = _stats;
+}
+
+void resetTLBStats(void)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
 void flushTLB(void)
 {
     memset(_tlb, 0, sizeof(_tlb));
+    memset(_plruBits, 0, sizeof(_plruBits));
+    memset(_clockHand, 0, sizeof(_clockHand));
+}
+
+// Returns the first entry of the set for the virtual address in the current
+// address space. Consecutive addresses and the same address in different
+// address spaces are spread over all sets by a multiplicative hash.
+static TLBEntry *findSet(uint32_t virtual, unsigned *setIndex)
+{
+    uint32_t set = 0;
+    if (_setBits > 0) {
+        set = ((virtual ^ ((uint32_t)_asid << 16)) * 0x9e3779b1u) >> (32 - _setBits);
+    }
+    *setIndex = set;
+    return &_tlb[set * _config.ways];
+}
+
+// Marks way as used in the PLRU tree of the set. The tree has a node for
+// every inner node of a binary tree over the ways, stored like a heap
+// starting at index 1. A node bit of 1 means the victim is in the right half.
+static void touchPLRU(unsigned set, unsigned way)
+{
+    uint32_t bits = _plruBits[set];
+    unsigned node = 1;
+    for (unsigned half = _config.ways / 2; half > 0; half /= 2) {
+        unsigned right = (way & half) != 0;
+        // Point away from the way just used.
+        if (right) {
+            bits &= ~(1u << node);
+        } else {
+            bits |= 1u << node;
+        }
+        node = 2 * node + right;
+    }
+    _plruBits[set] = bits;
+}
+
+static unsigned victimPLRU(unsigned set)
+{
+    uint32_t bits = _plruBits[set];
+    unsigned node = 1, way = 0;
+    for (unsigned half = _config.ways / 2; half > 0; half /= 2) {
+        unsigned right = (bits >> node) & 1;
+        way |= right ? half : 0;
+        node = 2 * node + right;
+    }
+    return way;
+}
+
+static void touchEntry(TLBEntry *entry, unsigned set, unsigned way)
+{
+    switch (_config.policy) {
+    case TLB_POLICY_LRU:
+        entry->lastAccess = ++_accessCounter;
+        break;
+    case TLB_POLICY_PLRU:
+        touchPLRU(set, way);
+        break;
+    case TLB_POLICY_CLOCK:
+        entry->referenced = 1;
+        break;
+    case TLB_POLICY_RANDOM:
+        break;
+    }
+}
+
+// Picks the way to replace in a full set.
+static unsigned findVictim(TLBEntry *entries, unsigned set)
+{
+    unsigned ways = _config.ways;
+    switch (_config.policy) {
+    case TLB_POLICY_LRU: {
+        unsigned oldest = 0;
+        for (unsigned i = 1; i < ways; i++) {
+            if (entries[i].lastAccess < entries[oldest].lastAccess) {
+                oldest = i;
+            }
+        }
+        return oldest;
+    }
+    case TLB_POLICY_PLRU:
+        return victimPLRU(set);
+    case TLB_POLICY_RANDOM:
+        // xorshift32
+        _randomState ^= _randomState << 13;
+        _randomState ^= _randomState >> 17;
+        _randomState ^= _randomState << 5;
+        return _randomState & (ways - 1);
+    case TLB_POLICY_CLOCK:
+        // Terminates after at most one round, clearing the bits it passes.
+        for (;;) {
+            unsigned hand = _clockHand[set];
+            _clockHand[set] = (hand + 1) & (ways - 1);
+            if (!entries[hand].referenced) {
+                return hand;
+            }
+            entries[hand].referenced = 0;
+        }
+    }
+    return 0;
 }
 
 void addToTLB(uint32_t virtual, uint32_t physical)
 {
-    // Find the oldest entry that is currently in the TLB.
-    // Invalid entries have an access time of 0, but are preferred.
-    int oldestEntry = 0;
-    for (int i = 1; i < TLB_SIZE; ++i) {
-        if (!_tlb[i].valid || (_tlb[i].lastAccess < _tlb[oldestEntry].lastAccess)) {
-            oldestEntry = i;
+    unsigned set;
+    TLBEntry *entries = findSet(virtual, &set);
+
+    // Reuse the entry if the address is already cached, otherwise prefer
+    // an invalid entry.
+    unsigned way = _config.ways;
+    for (unsigned i = 0; i < _config.ways; i++) {
+        if (entries[i].valid && (entries[i].virtual == virtual) &&
+            (entries[i].asid == _asid)) {
+            way = i;
+            break;
         }
+        if (!entries[i].valid && (way == _config.ways)) {
+            way = i;
+        }
+    }
+    if (way == _config.ways) {
+        way = findVictim(entries, set);
+        _stats.evictions++;
     }
 
     // Set that entry in the TLB.
-    _tlb[oldestEntry].valid    = 1;
-    _tlb[oldestEntry].physical = physical;
-    _tlb[oldestEntry].virtual  = virtual;
+    entries[way].valid    = 1;
+    entries[way].physical = physical;
+    entries[way].virtual  = virtual;
+    entries[way].asid     = _asid;
 
-    // Remember to set and increment the access counter, since this also
-    // counts as use of the entry.
-    _tlb[oldestEntry].lastAccess = _accessCounter++;
+    // Filling an entry also counts as use of the entry.
+    touchEntry(&entries[way], set, way);
 }
 
 int translateTLB(uint32_t *address)
@@ -86,17 +363,21 @@ int translateTLB(uint32_t *address)
         return -1;
     }
 
-    // We have a fully associative TLB. That means that we need to check
-    // every entry of the TLB.
-    for (int i = 0; i < TLB_SIZE; i++) {
-        if (_tlb[i].valid && (_tlb[i].virtual == *address)) {
+    // Only the set that the address maps to can hold its entry.
+    unsigned set;
+    TLBEntry *entries = findSet(*address, &set);
+    for (unsigned i = 0; i < _config.ways; i++) {
+        if (entries[i].valid && (entries[i].virtual == *address) &&
+            (entries[i].asid == _asid)) {
             // We found a TLB entry for this virtual address and use it.
-            *address = _tlb[i].physical;
+            *address = entries[i].physical;
 
-            _tlb[i].lastAccess = _accessCounter++;
+            touchEntry(&entries[i], set, i);
+            _stats.hits++;
             return 0;
         }
     }
 
+    _stats.misses++;
     return -1;
 }
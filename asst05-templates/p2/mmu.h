@@ -2,6 +2,7 @@
 #define MMU_H
 
 #include <inttypes.h>
+#include <stddef.h>
 
 //    3 bits                     29 bits
 // +---------+------------------------------------------------+
@@ -13,8 +14,13 @@
 // Number of segments (hardcoded)
 #define SEGMENT_COUNT (1UL << SEGMENT_BITS)
 
+// Default TLB: 4 entries, fully associative, LRU replacement.
 #define TLB_SIZE 4
 
+// Limits for configureTLB().
+#define TLB_MAX_ENTRIES 4096
+#define TLB_MAX_WAYS 32
+
 typedef struct {
     // Physical base address.
     uint32_t base;
@@ -26,15 +32,70 @@ typedef struct {
     Segment segments[SEGMENT_COUNT];
 } SegmentTable;
 
+// Switches to the segment table and flushes the TLB.
 void setSegmentTable(SegmentTable *segments);
 
+// Switches to the segment table of address space asid without flushing the
+// TLB. Cached translations are tagged with the address space they belong to.
+// Use different ASIDs for different segment tables.
+void setSegmentTableAsid(SegmentTable *segments, uint16_t asid);
+
+// Removes all translations of address space asid from the TLB, e.g., before
+// the ASID is reused for another segment table.
+void invalidateTLBAsid(uint16_t asid);
+
 // Translate a virtual address to the physical address.
 int translateSegmentTable(uint32_t *address);
 
+// Translates count virtual addresses with the segment table at once and
+// stores the physical addresses in physical. For an invalid virtual[i], bit
+// i % 64 of faults[i / 64] is set and physical[i] is virtual[i]. faults must
+// hold (count + 63) / 64 words. The number of invalid addresses is stored in
+// *numFaults unless it is NULL. The TLB is not used.
+// Returns -1 on error, 0 otherwise.
+int translateSegmentTableBatch(const uint32_t *virtual, uint32_t *physical,
+                               size_t count, uint64_t *faults,
+                               size_t *numFaults);
+
 void flushTLB(void);
 void addToTLB(uint32_t physical, uint32_t virtual);
 
 // Look up a physical address using the MMU.
 int translateTLB(uint32_t *address);
 
+typedef enum {
+    // Evict the least recently used entry of the set.
+    TLB_POLICY_LRU,
+    // Approximate LRU with a binary tree of ways - 1 bits per set.
+    TLB_POLICY_PLRU,
+    // Evict a random entry of the set.
+    TLB_POLICY_RANDOM,
+    // Second chance: skip entries used since the hand last passed them.
+    TLB_POLICY_CLOCK
+} TLBPolicy;
+
+typedef struct {
+    // Total number of entries. Power of two, at most TLB_MAX_ENTRIES.
+    unsigned entries;
+    // Entries per set. Power of two, at most TLB_MAX_WAYS and entries.
+    // Set ways = entries for a fully associative TLB.
+    unsigned ways;
+    TLBPolicy policy;
+} TLBConfig;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    // Entries replaced by addToTLB() while their set was full.
+    uint64_t evictions;
+} TLBStats;
+
+// Changes size, associativity and replacement policy of the TLB. This
+// flushes the TLB and resets the counters.
+// Returns -1 on error, 0 otherwise.
+int configureTLB(const TLBConfig *config);
+
+void getTLBStats(TLBStats *stats);
+void resetTLBStats(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "sorting.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Benchmark of the sorting algorithms. Build with:
+ *   gcc -O2 -o bench bench.c sorting.c -lpthread
+ * Sizes go from 10^3 to 10^maxExponent elements (default 7, pass e.g. 9 as
+ * the first argument for 10^9; this needs about 12 GB of memory). The
+ * external sort runs on a file of 10^maxExponent ints in /tmp.
+ */
+
+typedef enum { INPUT_RANDOM, INPUT_SORTED, INPUT_REVERSED, INPUT_FEW_UNIQUE } InputKind;
+
+static const char *_inputNames[] = {"random", "sorted", "reversed", "few unique"};
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_int(const void *a, const void *b)
+{
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static void libc_qsort(int *a, size_t len)
+{
+    qsort(a, len, sizeof(int), compare_int);
+}
+
+static void parallel_sort(int *a, size_t len)
+{
+    parallelMergeSort(a, len, 0);
+}
+
+static void radix_sort(int *a, size_t len)
+{
+    radixSort(a, len);
+}
+
+static void parallel_radix_sort(int *a, size_t len)
+{
+    parallelRadixSort(a, len, 0);
+}
+
+static void fill_input(int *a, size_t len, InputKind kind, uint64_t seed)
+{
+    uint64_t state = 88172645463325252ull + seed;
+    for (size_t i = 0; i < len; i++) {
+        // xorshift64, rand() is too slow for 10^9 elements.
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        switch (kind) {
+        case INPUT_RANDOM: a[i] = (int)state; break;
+        case INPUT_SORTED: a[i] = (int)i; break;
+        case INPUT_REVERSED: a[i] = (int)(len - i); break;
+        case INPUT_FEW_UNIQUE: a[i] = (int)(state % 16); break;
+        }
+    }
+}
+
+/*
+ * Sorts a file of length random ints with externalSort(), with an eighth of
+ * its size as memory.
+ */
+static void bench_external(size_t length)
+{
+    char input[] = "/tmp/sorting-benchXXXXXX", output[] = "/tmp/sorting-benchXXXXXX";
+    int inFd = mkstemp(input), outFd = mkstemp(output);
+    size_t piece = 1 << 20;
+    int *a = malloc(piece * sizeof(int));
+    if (inFd < 0 || outFd < 0 || a == NULL) {
+        printf("Cannot set up the external sort benchmark\n");
+        return;
+    }
+    for (size_t done = 0; done < length; done += piece) {
+        size_t n = (length - done < piece) ? length - done : piece;
+        fill_input(a, n, INPUT_RANDOM, done);
+        if (write(inFd, a, n * sizeof(int)) != (ssize_t)(n * sizeof(int))) {
+            printf("Cannot write the external sort input\n");
+            break;
+        }
+    }
+
+    double start = now_s();
+    int res = externalSort(input, output, length * sizeof(int) / 8, 0);
+    double elapsed = now_s() - start;
+    printf("externalSort of %zu ints with %zu KiB of memory: %.2f ns per element%s\n",
+           length, length * sizeof(int) / 8 / 1024, elapsed * 1e9 / length,
+           (res == 0) ? "" : " (failed)");
+
+    close(inFd);
+    close(outFd);
+    unlink(input);
+    unlink(output);
+    free(a);
+}
+
+typedef struct {
+    const char *name;
+    void (*sort)(int*, size_t);
+} Sorter;
+
+int main(int argc, char **argv)
+{
+    int maxExponent = (argc > 1) ? atoi(argv[1]) : 7;
+    Sorter sorters[] = {
+        {"qsort", libc_qsort},
+        {"mergeSort", mergeSort},
+        {"introSort", introSort},
+        {"parallelMergeSort", parallel_sort},
+        {"radixSort", radix_sort},
+        {"parallelRadixSort", parallel_radix_sort},
+    };
+    size_t numSorters = sizeof(sorters) / sizeof(sorters[0]);
+
+    printf("%12s %-11s", "elements", "input");
+    for (size_t s = 0; s < numSorters; s++) {
+        printf(" %18s", sorters[s].name);
+    }
+    printf("   (ns per element)\n");
+
+    size_t length = 1000;
+    for (int e = 3; e <= maxExponent; e++, length *= 10) {
+        int *a = malloc(length * sizeof(int));
+        if (a == NULL) {
+            printf("Out of memory for 10^%d elements\n", e);
+            return 1;
+        }
+        // Repeat small sizes to get measurable times. Every round gets new
+        // random numbers, so that the branch predictor cannot learn them.
+        size_t rounds = (length < 1000000) ? 1000000 / length : 1;
+
+        for (InputKind kind = INPUT_RANDOM; kind <= INPUT_FEW_UNIQUE; kind++) {
+            printf("%12zu %-11s", length, _inputNames[kind]);
+            for (size_t s = 0; s < numSorters; s++) {
+                double elapsed = 0;
+                for (size_t r = 0; r < rounds; r++) {
+                    fill_input(a, length, kind, r);
+                    double start = now_s();
+                    sorters[s].sort(a, length);
+                    elapsed += now_s() - start;
+                }
+                printf(" %18.2f", elapsed * 1e9 / (rounds * length));
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+        free(a);
+    }
+
+    bench_external(length / 10);
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include "sorting.h"
 #include "testlib.h"
 
@@ -69,6 +71,158 @@ static void test_array_sorted(int *supposedlySorted, size_t length, const char *
     free(msg); free(after);
 }
 
+static int compare_int(const void *a, const void *b)
+{
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+typedef enum { INPUT_RANDOM, INPUT_SORTED, INPUT_REVERSED, INPUT_FEW_UNIQUE, INPUT_EQUAL } InputKind;
+
+static void fill_input(int *a, size_t len, InputKind kind)
+{
+    for (size_t i = 0; i < len; i++) {
+        switch (kind) {
+        case INPUT_RANDOM: a[i] = rand() - RAND_MAX / 2; break;
+        case INPUT_SORTED: a[i] = (int)i; break;
+        case INPUT_REVERSED: a[i] = (int)(len - i); break;
+        case INPUT_FEW_UNIQUE: a[i] = rand() % 4; break;
+        case INPUT_EQUAL: a[i] = 7; break;
+        }
+    }
+}
+
+/* Sorts inputs of several kinds and sizes up to maxLength with sort and
+ * compares the result with qsort(). Returns the number of mismatches. */
+static int check_sorter(void (*sort)(int*, size_t), size_t maxLength)
+{
+    size_t lengths[] = {0, 1, 2, 3, 25, 129, 1000, 100000};
+    int errors = 0;
+
+    srand(4);
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t len = lengths[l];
+        if (len > maxLength)
+            break;
+        int *a = malloc((len + 1) * sizeof(int));
+        int *expected = malloc((len + 1) * sizeof(int));
+        for (InputKind kind = INPUT_RANDOM; kind <= INPUT_EQUAL; kind++) {
+            fill_input(a, len, kind);
+            memcpy(expected, a, len * sizeof(int));
+            qsort(expected, len, sizeof(int), compare_int);
+            sort(a, len);
+            if (memcmp(a, expected, len * sizeof(int)) != 0)
+                errors++;
+        }
+        free(a);
+        free(expected);
+    }
+    return errors;
+}
+
+/* Sorts random inputs of every length up to maxLength, with INT_MIN and
+ * INT_MAX mixed in, and compares the result with qsort(). Returns the number
+ * of mismatches. */
+static int check_all_lengths(void (*sort)(int*, size_t), size_t maxLength)
+{
+    int *a = malloc((maxLength + 1) * sizeof(int));
+    int *expected = malloc((maxLength + 1) * sizeof(int));
+    int errors = 0;
+
+    srand(5);
+    for (size_t len = 0; len <= maxLength; len++) {
+        for (size_t i = 0; i < len; i++) {
+            int r = rand();
+            a[i] = (r % 16 == 0) ? 2147483647 : (r % 16 == 1) ? -2147483647 - 1 : r % 1000;
+        }
+        memcpy(expected, a, len * sizeof(int));
+        qsort(expected, len, sizeof(int), compare_int);
+        sort(a, len);
+        if (memcmp(a, expected, len * sizeof(int)) != 0)
+            errors++;
+    }
+    free(a);
+    free(expected);
+    return errors;
+}
+
+/* Writes length random ints to a temporary file, sorts it with externalSort()
+ * using memory bytes, into the same file if inPlace is set, and compares the
+ * result with qsort(). Returns the number of mismatching elements, or -1 if
+ * sorting failed. */
+static long check_external(size_t length, size_t memory, bool inPlace)
+{
+    char input[] = "/tmp/sorting-inXXXXXX", output[] = "/tmp/sorting-outXXXXXX";
+    int inFd = mkstemp(input), outFd = mkstemp(output);
+    int *a = malloc((length + 1) * sizeof(int));
+    int *sorted = malloc((length + 1) * sizeof(int));
+    long errors = 0;
+
+    srand(6);
+    fill_input(a, length, INPUT_RANDOM);
+    if (write(inFd, a, length * sizeof(int)) != (ssize_t)(length * sizeof(int)))
+        errors = -1;
+    qsort(a, length, sizeof(int), compare_int);
+    if (errors == 0 && externalSort(input, inPlace ? input : output, memory, 2) != 0)
+        errors = -1;
+    if (errors == 0) {
+        FILE *f = fopen(inPlace ? input : output, "rb");
+        size_t got = fread(sorted, sizeof(int), length + 1, f);
+        fclose(f);
+        errors = (long)(got > length ? got - length : length - got);
+        for (size_t i = 0; i < length && i < got; i++)
+            errors += a[i] != sorted[i];
+    }
+    close(inFd);
+    close(outFd);
+    unlink(input);
+    unlink(output);
+    free(a);
+    free(sorted);
+    return errors;
+}
+
+static unsigned _threads;
+
+/* Runs check_sorter() with the address space limited to a few MiB more than
+ * in use, so that no thread stacks can be mapped and thread creation fails.
+ * Returns the number of mismatches. */
+static int check_without_threads(void (*sort)(int*, size_t), size_t maxLength)
+{
+    struct rlimit unlimited, limited;
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL || fscanf(statm, "%ld", &pages) != 1 || getrlimit(RLIMIT_AS, &unlimited) != 0)
+        return -1;
+    fclose(statm);
+
+    limited = unlimited;
+    limited.rlim_cur = pages * sysconf(_SC_PAGESIZE) + (4 << 20);
+    if (setrlimit(RLIMIT_AS, &limited) != 0)
+        return -1;
+    int errors = check_sorter(sort, maxLength);
+    setrlimit(RLIMIT_AS, &unlimited);
+    return errors;
+}
+
+static void parallel_sort(int *a, size_t len)
+{
+    if (parallelMergeSort(a, len, _threads) != 0)
+        memset(a, 0, len * sizeof(int));
+}
+
+static void radix_sort(int *a, size_t len)
+{
+    if (radixSort(a, len) != 0)
+        memset(a, 0, len * sizeof(int));
+}
+
+static void parallel_radix_sort(int *a, size_t len)
+{
+    if (parallelRadixSort(a, len, _threads) != 0)
+        memset(a, 0, len * sizeof(int));
+}
+
 int main()
 {
     test_start("sorting.c");
@@ -85,5 +239,41 @@ int main()
     pancakeSort(pancakeSortArray, LENGTH);
     test_array_sorted(pancakeSortArray, LENGTH, "pancakeSort");
 
+    test_equals_int(check_sorter(insertionSort, 1000), 0, "insertionSort sorts all kinds of input");
+    test_equals_int(check_sorter(mergeSort, 100000), 0, "mergeSort sorts all kinds of input");
+    test_equals_int(check_all_lengths(mergeSort, 300), 0, "mergeSort sorts inputs of every length up to 300");
+    test_equals_int(check_sorter(introSort, 100000), 0, "introSort sorts all kinds of input");
+    unsigned threadCounts[] = {1, 2, 3, 8, 0};
+    for (size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); i++) {
+        _threads = threadCounts[i];
+        char msg[64];
+        snprintf(msg, sizeof(msg), "parallelMergeSort with %u threads sorts all kinds of input", _threads);
+        test_equals_int(check_sorter(parallel_sort, 100000), 0, msg);
+        snprintf(msg, sizeof(msg), "parallelRadixSort with %u threads sorts all kinds of input", _threads);
+        test_equals_int(check_sorter(parallel_radix_sort, 100000), 0, msg);
+    }
+    test_equals_int(check_sorter(radix_sort, 100000), 0, "radixSort sorts all kinds of input");
+    _threads = 8;
+    test_equals_int(check_without_threads(parallel_sort, 100000), 0, "parallelMergeSort sorts on the calling thread if no threads can be started");
+    test_equals_int(check_without_threads(parallel_radix_sort, 100000), 0, "parallelRadixSort sorts on the calling thread if no threads can be started");
+
+    test_equals_int64(check_external(0, 1 << 20, false), 0, "externalSort sorts an empty file");
+    test_equals_int64(check_external(100000, 1 << 20, false), 0, "externalSort sorts a file that fits into memory");
+    test_equals_int64(check_external(200000, 1 << 20, false), 0, "externalSort merges runs in a single pass");
+    test_equals_int64(check_external(300000, 256 * 1024, false), 0, "externalSort merges runs in several passes");
+    test_equals_int64(check_external(100000, 1 << 20, true), 0, "externalSort sorts a file that fits into memory in place");
+    test_equals_int64(check_external(300000, 256 * 1024, true), 0, "externalSort sorts a file with several runs in place");
+    test_equals_int(externalSort("/nonexistent/input", "/tmp/sorting-unused", 1 << 20, 1), -1, "externalSort fails for a missing input file");
+
+    int extremes[] = {0, -1, 2147483647, -2147483647 - 1, 1, -65536, 65536, 255, -256};
+    int extremesLength = sizeof(extremes) / sizeof(extremes[0]);
+    int *many = malloc(300 * sizeof(int));
+    for (int i = 0; i < 300; i++)
+        many[i] = extremes[i % extremesLength];
+    radixSort(many, 300);
+    test_assert(many[0] == -2147483647 - 1 && many[299] == 2147483647, "radixSort orders INT_MIN and INT_MAX correctly");
+    test_array_sorted(many, 20, "radixSort");
+    free(many);
+
     return test_end();
 }
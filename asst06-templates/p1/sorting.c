@@ -1,6 +1,57 @@
 #include "sorting.h"
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Set to 0 to use the portable scalar code only */
+#define SORTING_SIMD 1
+
+#if SORTING_SIMD && defined(__x86_64__)
+#include <immintrin.h>
+#define SORTING_AVX2 1
+#define AVX2 __attribute__((target("avx2")))
+#else
+#define SORTING_AVX2 0
+#endif
+
+/*
+ * Ranges of at most this many elements are sorted with insertion sort by
+ * introSort() and mergeSort().
+ */
+#define INSERTION_SORT_CUTOFF 24
+
+/*
+ * introSort() uses the median of three medians of three for ranges longer
+ * than this.
+ */
+#define NINTHER_THRESHOLD 128
+
+/*
+ * parallelMergeSort() does not split the array into pieces smaller than this.
+ */
+#define PARALLEL_MIN_PIECE 4096
+
+/*
+ * With AVX2, mergeSort() sorts ranges of at most this many elements with a
+ * sorting network instead of insertion sort.
+ */
+#define SIMD_SORT_BLOCK 64
+
+/*
+ * Radix sort uses 8 bit digits (4 passes) for short arrays and 11 bit digits
+ * (3 passes) from RADIX_WIDE_MIN elements on, when the larger histograms pay
+ * off. Below RADIX_MIN elements, it uses introSort().
+ */
+#define RADIX_MIN 256
+#define RADIX_WIDE_MIN (1 << 16)
+#define RADIX_MAX_BITS 11
+#define RADIX_MAX_PASSES 4
+#define RADIX_MAX_BUCKETS (1 << RADIX_MAX_BITS)
 
 /**
  * Swap both Integers the pointers are pointing to with each other.
@@ -13,14 +64,18 @@ void swap(int *pointer1, int *pointer2) {
 
 /**
  * Sorts the array toSort with given length ascending using insertion sort.
+ * Larger elements are shifted up by one instead of being swapped.
  */
 void insertionSort(int *toSort, size_t length) {
   if (toSort == NULL)
     return;
-  for (size_t i = 1; i < length; ++i)
-    for (size_t j = 0; j < i; ++j)
-      if (toSort[j] > toSort[i])
-        swap(&toSort[j], &toSort[i]);
+  for (size_t i = 1; i < length; ++i) {
+    int value = toSort[i];
+    size_t j = i;
+    for (; j > 0 && toSort[j - 1] > value; --j)
+      toSort[j] = toSort[j - 1];
+    toSort[j] = value;
+  }
 }
 
 /**
@@ -35,6 +90,215 @@ int *copy(int *src, size_t length) {
   return dest;
 }
 
+/*
+ * Merges the sorted arrays left and right into dest without branching on
+ * the data, which is unpredictable for random input.
+ */
+static void mergeRunsScalar(const int *left, size_t leftLength,
+                            const int *right, size_t rightLength, int *dest) {
+  const int *leftEnd = left + leftLength;
+  const int *rightEnd = right + rightLength;
+  while (left < leftEnd && right < rightEnd) {
+    int l = *left, r = *right;
+    int takeLeft = l <= r;
+    *dest++ = takeLeft ? l : r;
+    left += takeLeft;
+    right += !takeLeft;
+  }
+  memcpy(dest, left, (leftEnd - left) * sizeof(int));
+  dest += leftEnd - left;
+  memcpy(dest, right, (rightEnd - right) * sizeof(int));
+}
+
+#if SORTING_AVX2
+/*
+ * Compare-exchange of every lane with the lane whose index differs in bit 0,
+ * 1 or 2. Lanes set in the immediate maxLanes keep the larger value.
+ */
+#define MINMAX_BLEND(v, partner, maxLanes)                                     \
+  _mm256_blend_epi32(_mm256_min_epi32(v, partner),                             \
+                     _mm256_max_epi32(v, partner), maxLanes)
+#define EXCHANGE1(v, maxLanes)                                                 \
+  MINMAX_BLEND(v, _mm256_shuffle_epi32(v, 0xB1), maxLanes)
+#define EXCHANGE2(v, maxLanes)                                                 \
+  MINMAX_BLEND(v, _mm256_shuffle_epi32(v, 0x4E), maxLanes)
+#define EXCHANGE4(v, maxLanes)                                                 \
+  MINMAX_BLEND(v, _mm256_permute2x128_si256(v, v, 0x01), maxLanes)
+
+/* Puts the smaller values into *a and the larger ones into *b, lane by lane */
+#define COMPARE_EXCHANGE(a, b)                                                 \
+  do {                                                                         \
+    __m256i min_ = _mm256_min_epi32(a, b);                                     \
+    b = _mm256_max_epi32(a, b);                                                \
+    a = min_;                                                                  \
+  } while (0)
+
+/* Sorts the bitonic sequence in v ascending */
+AVX2 static inline __m256i bitonicClean8(__m256i v) {
+  v = EXCHANGE4(v, 0xF0);
+  v = EXCHANGE2(v, 0xCC);
+  return EXCHANGE1(v, 0xAA);
+}
+
+/* Sorts the eight lanes of v ascending with a bitonic network */
+AVX2 static inline __m256i bitonicSort8(__m256i v) {
+  // Pairs alternately ascending and descending, then quads, then all.
+  v = EXCHANGE1(v, 0x66);
+  v = EXCHANGE2(v, 0x3C);
+  v = EXCHANGE1(v, 0x5A);
+  return bitonicClean8(v);
+}
+
+AVX2 static inline __m256i reverse8(__m256i v) {
+  return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+/*
+ * Merges the sorted vectors v[0...n-1] and v[n...2n-1] into the sorted
+ * vectors v[0...2n-1]. n must be a power of two.
+ */
+AVX2 static inline void bitonicMerge(__m256i *v, size_t n) {
+  // Reversing the second run makes the whole sequence bitonic.
+  for (size_t i = n, j = 2 * n - 1; i <= j; ++i, --j) {
+    __m256i t = reverse8(v[i]);
+    v[i] = reverse8(v[j]);
+    v[j] = t;
+  }
+  for (size_t stride = n; stride > 0; stride /= 2)
+    for (size_t block = 0; block < 2 * n; block += 2 * stride)
+      for (size_t i = block; i < block + stride; ++i)
+        COMPARE_EXCHANGE(v[i], v[i + stride]);
+  for (size_t i = 0; i < 2 * n; ++i)
+    v[i] = bitonicClean8(v[i]);
+}
+
+/* Sorts the 16 values in v[0] and v[1] */
+AVX2 static inline void bitonicSort16(__m256i *v) {
+  v[0] = bitonicSort8(v[0]);
+  v[1] = bitonicSort8(v[1]);
+  bitonicMerge(v, 1);
+}
+
+/* Transposes the 8x8 matrix with the rows v[0...7] */
+AVX2 static inline void transpose8x8(__m256i *v) {
+  __m256i t[8], u[8];
+  for (int i = 0; i < 8; i += 2) {
+    t[i] = _mm256_unpacklo_epi32(v[i], v[i + 1]);
+    t[i + 1] = _mm256_unpackhi_epi32(v[i], v[i + 1]);
+  }
+  for (int i = 0; i < 8; i += 4) {
+    u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+    u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+    u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+    u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+  }
+  for (int i = 0; i < 4; ++i) {
+    v[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+    v[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+  }
+}
+
+/* Sorts the 64 values in v[0...7] */
+AVX2 static inline void bitonicSort64(__m256i *v) {
+  // Sort the columns with the optimal 19 comparator network for eight
+  // inputs, which turns the rows into eight sorted runs after a transpose.
+  static const unsigned char network[19][2] = {
+      {0, 2}, {1, 3}, {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6},
+      {3, 7}, {0, 1}, {2, 3}, {4, 5}, {6, 7}, {2, 4}, {3, 5},
+      {1, 4}, {3, 6}, {1, 2}, {3, 4}, {5, 6}};
+  for (int i = 0; i < 19; ++i)
+    COMPARE_EXCHANGE(v[network[i][0]], v[network[i][1]]);
+  transpose8x8(v);
+  for (size_t run = 1; run < 8; run *= 2)
+    for (size_t i = 0; i < 8; i += 2 * run)
+      bitonicMerge(v + i, run);
+}
+
+/*
+ * Sorts the array toSort of at most SIMD_SORT_BLOCK elements. The values are
+ * padded with INT_MAX to the size of the next network.
+ */
+AVX2 static void sortBlockAvx2(int *toSort, size_t length) {
+  _Alignas(32) int block[SIMD_SORT_BLOCK];
+  __m256i v[SIMD_SORT_BLOCK / 8];
+  size_t vectors = (length <= 8) ? 1 : (length <= 16) ? 2 : 8;
+  memcpy(block, toSort, length * sizeof(int));
+  for (size_t i = length; i < vectors * 8; ++i)
+    block[i] = INT_MAX;
+  for (size_t i = 0; i < vectors; ++i)
+    v[i] = _mm256_load_si256((const __m256i *)block + i);
+  if (vectors == 1)
+    v[0] = bitonicSort8(v[0]);
+  else if (vectors == 2)
+    bitonicSort16(v);
+  else
+    bitonicSort64(v);
+  for (size_t i = 0; i < vectors; ++i)
+    _mm256_store_si256((__m256i *)block + i, v[i]);
+  memcpy(toSort, block, length * sizeof(int));
+}
+
+/*
+ * Merges the sorted arrays left and right, both at least eight elements
+ * long, into dest, eight elements at a time. The larger half of every
+ * 16 element merge stays in a register and is merged with the next eight
+ * elements of the run whose next element is smaller.
+ */
+AVX2 static void mergeRunsAvx2(const int *left, size_t leftLength,
+                               const int *right, size_t rightLength,
+                               int *dest) {
+  const int *leftEnd = left + leftLength;
+  const int *rightEnd = right + rightLength;
+  __m256i v[2];
+  v[0] = _mm256_loadu_si256((const __m256i *)left);
+  v[1] = _mm256_loadu_si256((const __m256i *)right);
+  left += 8;
+  right += 8;
+  bitonicMerge(v, 1);
+  _mm256_storeu_si256((__m256i *)dest, v[0]);
+  dest += 8;
+  while (leftEnd - left >= 8 && rightEnd - right >= 8) {
+    int takeLeft = *left <= *right;
+    const int *next = takeLeft ? left : right;
+    left += takeLeft ? 8 : 0;
+    right += takeLeft ? 0 : 8;
+    v[0] = _mm256_loadu_si256((const __m256i *)next);
+    bitonicMerge(v, 1);
+    _mm256_storeu_si256((__m256i *)dest, v[0]);
+    dest += 8;
+  }
+
+  // Merge the eight pending values with the rest of the shorter run, which
+  // is less than eight long, and the result with the rest of the other.
+  int pending[8], shortMerged[16];
+  _mm256_storeu_si256((__m256i *)pending, v[1]);
+  if (leftEnd - left < 8) {
+    mergeRunsScalar(pending, 8, left, leftEnd - left, shortMerged);
+    mergeRunsScalar(shortMerged, 8 + (leftEnd - left), right, rightEnd - right,
+                    dest);
+  } else {
+    mergeRunsScalar(pending, 8, right, rightEnd - right, shortMerged);
+    mergeRunsScalar(shortMerged, 8 + (rightEnd - right), left, leftEnd - left,
+                    dest);
+  }
+}
+#endif
+
+/**
+ * Merges the sorted arrays left and right into dest, with AVX2 if the CPU
+ * supports it.
+ */
+void mergeRuns(const int *left, size_t leftLength, const int *right,
+               size_t rightLength, int *dest) {
+#if SORTING_AVX2
+  if (leftLength >= 8 && rightLength >= 8 && __builtin_cpu_supports("avx2")) {
+    mergeRunsAvx2(left, leftLength, right, rightLength, dest);
+    return;
+  }
+#endif
+  mergeRunsScalar(left, leftLength, right, rightLength, dest);
+}
+
 /**
  * Merge src array which contains two sorted sub array src[start...middle - 1]
  * and src[middle...end-1]. The sub arrays are merged into destToMergeInto with
@@ -44,25 +308,26 @@ void merge(int *src, size_t start, size_t middle, size_t end,
            int *destToMergeInto) {
   if (src == NULL || destToMergeInto == NULL)
     return;
-  size_t leftIndex = start;
-  size_t rightIndex = middle;
-  for (size_t i = start; i < end; ++i) {
-    if (leftIndex < middle &&
-        (rightIndex >= end || src[leftIndex] <= src[rightIndex])) {
-      destToMergeInto[i] = src[leftIndex++];
-    } else {
-      destToMergeInto[i] = src[rightIndex++];
-    }
-  }
+  mergeRuns(src + start, middle - start, src + middle, end - middle,
+            destToMergeInto + start);
 }
 
 /**
  * Sorts the array srcToSort recursively with merge sort.
  * Start and end indicate the current window of srcToSort array this call sorts.
- * The result will be in sortedDest.
+ * The result will be in sortedDest, which holds the same elements as
+ * srcToSort in the window when called.
  */
 void mergeSortRec(int *srcToSort, size_t start, size_t end, int *sortedDest) {
-  if (end - start > 1) {
+#if SORTING_AVX2
+  if (end - start <= SIMD_SORT_BLOCK && __builtin_cpu_supports("avx2")) {
+    sortBlockAvx2(sortedDest + start, end - start);
+    return;
+  }
+#endif
+  if (end - start <= INSERTION_SORT_CUTOFF) {
+    insertionSort(sortedDest + start, end - start);
+  } else {
     size_t middle = (end + start) / 2;
     mergeSortRec(sortedDest, start, middle, srcToSort);
     mergeSortRec(sortedDest, middle, end, srcToSort);
@@ -74,11 +339,987 @@ void mergeSortRec(int *srcToSort, size_t start, size_t end, int *sortedDest) {
  * Sorts the array toSort with given length ascending using merge sort.
  */
 void mergeSort(int *toSort, size_t length) {
+  if (toSort == NULL || length < 2)
+    return;
   int *copyToSort = copy(toSort, length);
+  if (copyToSort == NULL)
+    return;
   mergeSortRec(copyToSort, 0, length, toSort);
   free(copyToSort);
 }
 
+/**
+ * Moves the median of a, b and c to b.
+ */
+static void sort3(int *a, int *b, int *c) {
+  if (*b < *a)
+    swap(a, b);
+  if (*c < *b) {
+    swap(b, c);
+    if (*b < *a)
+      swap(a, b);
+  }
+}
+
+/**
+ * Restores the max-heap property below index root of heap[0...length-1].
+ */
+static void siftDown(int *heap, size_t root, size_t length) {
+  int value = heap[root];
+  for (;;) {
+    size_t child = 2 * root + 1;
+    if (child >= length)
+      break;
+    if (child + 1 < length && heap[child] < heap[child + 1])
+      child++;
+    if (heap[child] <= value)
+      break;
+    heap[root] = heap[child];
+    root = child;
+  }
+  heap[root] = value;
+}
+
+/**
+ * Sorts the array toSort ascending using heap sort. introSort() falls back to
+ * this when the recursion gets too deep, which bounds it to O(n log n).
+ */
+static void heapSort(int *toSort, size_t length) {
+  for (size_t i = length / 2; i > 0; --i)
+    siftDown(toSort, i - 1, length);
+  for (size_t i = length - 1; i > 0; --i) {
+    swap(&toSort[0], &toSort[i]);
+    siftDown(toSort, 0, i);
+  }
+}
+
+/**
+ * Partitions toSort[0...length-1] around the pivot in toSort[0]. Elements
+ * equal to the pivot end up on the left. Returns the final position of the
+ * pivot. Used when the pivot equals the element in front of the range: then
+ * no element is smaller and all copies of the pivot are done at once.
+ */
+static size_t partitionLeft(int *toSort, size_t length) {
+  int pivot = toSort[0];
+  size_t left = 0, right = length;
+  for (;;) {
+    while (pivot < toSort[--right])
+      ;
+    while (left < right && !(pivot < toSort[++left]))
+      ;
+    if (left >= right)
+      break;
+    swap(&toSort[left], &toSort[right]);
+  }
+  swap(&toSort[0], &toSort[right]);
+  return right;
+}
+
+/**
+ * Partitions toSort[0...length-1] around the pivot in toSort[0]. Returns the
+ * final position of the pivot: smaller or equal elements are in front of it,
+ * greater or equal elements behind it.
+ */
+static size_t partitionRight(int *toSort, size_t length) {
+  int pivot = toSort[0];
+  size_t left = 0, right = length;
+  // The median selection guarantees that these loops stop inside the range.
+  while (toSort[++left] < pivot)
+    ;
+  while (!(toSort[--right] < pivot) && right > left)
+    ;
+  while (left < right) {
+    swap(&toSort[left], &toSort[right]);
+    while (toSort[++left] < pivot)
+      ;
+    while (!(toSort[--right] < pivot))
+      ;
+  }
+  swap(&toSort[0], &toSort[left - 1]);
+  return left - 1;
+}
+
+static void introSortRec(int *toSort, size_t length, int depthLimit,
+                         int leftmost) {
+  while (length > INSERTION_SORT_CUTOFF) {
+    if (depthLimit-- == 0) {
+      heapSort(toSort, length);
+      return;
+    }
+
+    // Move the pivot to the front. The median of three (or a ninther for
+    // large ranges) avoids the quadratic cases of sorted and reversed input.
+    size_t half = length / 2;
+    if (length > NINTHER_THRESHOLD) {
+      sort3(&toSort[0], &toSort[half], &toSort[length - 1]);
+      sort3(&toSort[1], &toSort[half - 1], &toSort[length - 2]);
+      sort3(&toSort[2], &toSort[half + 1], &toSort[length - 3]);
+      sort3(&toSort[half - 1], &toSort[half], &toSort[half + 1]);
+    } else {
+      sort3(&toSort[0], &toSort[half], &toSort[length - 1]);
+    }
+    swap(&toSort[0], &toSort[half]);
+
+    // Many equal keys: if the element in front of the range equals the
+    // pivot, nothing in the range is smaller, so all copies of it are put
+    // in place at once and only the right part remains.
+    if (!leftmost && !(toSort[-1] < toSort[0])) {
+      size_t pivot = partitionLeft(toSort, length);
+      toSort += pivot + 1;
+      length -= pivot + 1;
+      continue;
+    }
+
+    size_t pivot = partitionRight(toSort, length);
+
+    // Recurse into the smaller part and loop on the larger one to keep the
+    // stack depth logarithmic.
+    size_t leftLength = pivot, rightLength = length - pivot - 1;
+    if (leftLength < rightLength) {
+      introSortRec(toSort, leftLength, depthLimit, leftmost);
+      toSort += pivot + 1;
+      length = rightLength;
+      leftmost = 0;
+    } else {
+      introSortRec(toSort + pivot + 1, rightLength, depthLimit, 0);
+      length = leftLength;
+    }
+  }
+  insertionSort(toSort, length);
+}
+
+/**
+ * Sorts the array toSort with given length ascending using introsort: quick
+ * sort with median-of-three pivots, insertion sort for short ranges and heap
+ * sort if the recursion gets too deep.
+ */
+void introSort(int *toSort, size_t length) {
+  if (toSort == NULL || length < 2)
+    return;
+  int depthLimit = 2 * (63 - __builtin_clzll(length));
+  introSortRec(toSort, length, depthLimit, 1);
+}
+
+/*
+ * Returns the number of online CPUs, the default number of threads.
+ */
+static unsigned onlineCpus(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return (cpus > 0) ? (unsigned)cpus : 1;
+}
+
+/*
+ * A piece of work for one thread of parallelMergeSort(): either sort a chunk,
+ * or merge the given parts of two runs.
+ */
+typedef struct {
+  int *toSort;
+  size_t length;
+  const int *left;
+  size_t leftLength;
+  const int *right;
+  size_t rightLength;
+  int *dest;
+} SortTask;
+
+static void *sortTask(void *arg) {
+  SortTask *task = arg;
+  if (task->toSort != NULL)
+    introSort(task->toSort, task->length);
+  else
+    mergeRuns(task->left, task->leftLength, task->right, task->rightLength,
+              task->dest);
+  return NULL;
+}
+
+/*
+ * Runs the tasks on separate threads and waits for them. If not all threads
+ * can be started, the calling thread runs the remaining tasks itself, so all
+ * tasks are done on return.
+ */
+static void runTasks(SortTask *tasks, size_t count) {
+  pthread_t *threads = malloc(count * sizeof(pthread_t));
+  // The calling thread takes the first task itself.
+  size_t started = 1;
+  while (threads != NULL && started < count &&
+         pthread_create(&threads[started], NULL, sortTask, &tasks[started]) == 0)
+    ++started;
+  sortTask(&tasks[0]);
+  for (size_t i = started; i < count; ++i)
+    sortTask(&tasks[i]);
+  for (size_t i = 1; i < started; ++i)
+    pthread_join(threads[i], NULL);
+  free(threads);
+}
+
+/*
+ * Returns how many elements of left are among the first k elements of the
+ * merge of left and right, so that the merge can be split into independent
+ * parts.
+ */
+static size_t splitMerge(const int *left, size_t leftLength, const int *right,
+                         size_t rightLength, size_t k) {
+  size_t low = (k > rightLength) ? k - rightLength : 0;
+  size_t high = (k < leftLength) ? k : leftLength;
+  while (low < high) {
+    size_t i = low + (high - low) / 2;
+    // Take i elements from left and k - i from right. Left wins ties.
+    if (left[i] <= right[k - i - 1])
+      low = i + 1;
+    else
+      high = i;
+  }
+  return low;
+}
+
+/**
+ * Sorts the array toSort with given length ascending using numThreads
+ * threads, or one per online CPU if numThreads is 0. Chunks are sorted in
+ * parallel, then merged pairwise, with every merge split across the
+ * threads. If not all threads can be started, the sort goes on with fewer.
+ * Returns -1 if no memory can be allocated, which leaves toSort unchanged,
+ * 0 otherwise.
+ */
+int parallelMergeSort(int *toSort, size_t length, unsigned numThreads) {
+  if (toSort == NULL)
+    return -1;
+  if (numThreads == 0)
+    numThreads = onlineCpus();
+  size_t chunks = numThreads;
+  if (chunks > length / PARALLEL_MIN_PIECE)
+    chunks = length / PARALLEL_MIN_PIECE;
+  if (chunks < 2) {
+    introSort(toSort, length);
+    return 0;
+  }
+
+  int *buffer = malloc(length * sizeof(int));
+  SortTask *tasks = malloc(chunks * sizeof(SortTask));
+  size_t *bounds = malloc((chunks + 1) * sizeof(size_t));
+  if (buffer == NULL || tasks == NULL || bounds == NULL) {
+    free(buffer);
+    free(tasks);
+    free(bounds);
+    return -1;
+  }
+
+  // Sort the chunks.
+  for (size_t i = 0; i <= chunks; ++i)
+    bounds[i] = length * i / chunks;
+  for (size_t i = 0; i < chunks; ++i)
+    tasks[i] = (SortTask){.toSort = toSort + bounds[i],
+                          .length = bounds[i + 1] - bounds[i]};
+  runTasks(tasks, chunks);
+
+  // Merge neighbouring runs until one is left. Every merge gets an equal
+  // share of the threads and is split at evenly spaced output positions.
+  int *src = toSort, *dest = buffer;
+  size_t runs = chunks;
+  while (runs > 1) {
+    size_t numTasks = 0;
+    for (size_t r = 0; r < runs; r += 2) {
+      size_t start = bounds[r];
+      if (r + 1 == runs) {
+        // An odd run out is only copied.
+        tasks[numTasks++] = (SortTask){.left = src + start,
+                                       .leftLength = length - start,
+                                       .right = src + length,
+                                       .dest = dest + start};
+        continue;
+      }
+      const int *left = src + start, *right = src + bounds[r + 1];
+      size_t leftLength = bounds[r + 1] - start;
+      size_t rightLength = bounds[r + 2] - bounds[r + 1];
+      size_t total = leftLength + rightLength;
+      size_t parts = chunks / ((runs + 1) / 2);
+      if (parts < 1)
+        parts = 1;
+
+      size_t prevK = 0, prevI = 0;
+      for (size_t p = 1; p <= parts; ++p) {
+        size_t k = total * p / parts;
+        size_t i = splitMerge(left, leftLength, right, rightLength, k);
+        tasks[numTasks++] = (SortTask){.left = left + prevI,
+                                       .leftLength = i - prevI,
+                                       .right = right + (prevK - prevI),
+                                       .rightLength = (k - i) - (prevK - prevI),
+                                       .dest = dest + start + prevK};
+        prevK = k;
+        prevI = i;
+      }
+    }
+    runTasks(tasks, numTasks);
+
+    // The merged runs start at every second bound.
+    size_t merged = 0;
+    for (size_t r = 0; r < runs; r += 2)
+      bounds[merged++] = bounds[r];
+    bounds[merged] = length;
+    runs = merged;
+
+    int *tmp = src;
+    src = dest;
+    dest = tmp;
+  }
+
+  if (src != toSort)
+    memcpy(toSort, src, length * sizeof(int));
+  free(buffer);
+  free(tasks);
+  free(bounds);
+  return 0;
+}
+
+/*
+ * Digit layout of a radix sort. Keys are the ints with the sign bit flipped,
+ * so that negative numbers sort before positive ones as unsigned values.
+ */
+typedef struct {
+  unsigned bits;
+  unsigned passes;
+  size_t buckets;
+} RadixLayout;
+
+static RadixLayout radixLayout(size_t length) {
+  unsigned bits = (length >= RADIX_WIDE_MIN) ? RADIX_MAX_BITS : 8;
+  return (RadixLayout){.bits = bits,
+                       .passes = (32 + bits - 1) / bits,
+                       .buckets = (size_t)1 << bits};
+}
+
+static inline size_t radixDigit(int value, unsigned shift, size_t buckets) {
+  return (((uint32_t)value ^ 0x80000000u) >> shift) & (buckets - 1);
+}
+
+/*
+ * Counts the digits of all passes of src[0...length-1] in a single read of
+ * the array. hist holds passes * buckets counters and is cleared first.
+ */
+static void radixHistograms(const int *src, size_t length, RadixLayout layout,
+                            size_t *hist) {
+  memset(hist, 0, layout.passes * layout.buckets * sizeof(size_t));
+  for (size_t i = 0; i < length; ++i)
+    for (unsigned p = 0; p < layout.passes; ++p)
+      hist[p * layout.buckets +
+           radixDigit(src[i], p * layout.bits, layout.buckets)]++;
+}
+
+/*
+ * Counts the digits at shift of src[0...length-1].
+ */
+static void radixCount(const int *src, size_t length, unsigned shift,
+                       size_t buckets, size_t *count) {
+  memset(count, 0, buckets * sizeof(size_t));
+  for (size_t i = 0; i < length; ++i)
+    count[radixDigit(src[i], shift, buckets)]++;
+}
+
+/*
+ * Moves every element of src[0...length-1] to dest[offsets[digit]++].
+ */
+static void radixScatter(const int *src, size_t length, int *dest,
+                         unsigned shift, size_t buckets, size_t *offsets) {
+  for (size_t i = 0; i < length; ++i) {
+    int value = src[i];
+    dest[offsets[radixDigit(value, shift, buckets)]++] = value;
+  }
+}
+
+/*
+ * Returns 1 if all elements have the same digit in the histogram, so that
+ * the pass would not move anything.
+ */
+static int radixPassIsTrivial(const size_t *count, size_t buckets,
+                              size_t length) {
+  for (size_t d = 0; d < buckets; ++d)
+    if (count[d] != 0)
+      return count[d] == length;
+  return 1;
+}
+
+/**
+ * Sorts the array toSort with given length ascending using LSD radix sort.
+ * Passes over digits that are the same for all elements are skipped.
+ * Returns -1 on error, 0 otherwise.
+ */
+int radixSort(int *toSort, size_t length) {
+  if (toSort == NULL)
+    return -1;
+  if (length < RADIX_MIN) {
+    introSort(toSort, length);
+    return 0;
+  }
+
+  RadixLayout layout = radixLayout(length);
+  int *buffer = malloc(length * sizeof(int));
+  size_t *hist = malloc(layout.passes * layout.buckets * sizeof(size_t));
+  if (buffer == NULL || hist == NULL) {
+    free(buffer);
+    free(hist);
+    return -1;
+  }
+
+  // The histograms do not change between passes: every pass only reorders
+  // the elements. They are thus all computed up front.
+  radixHistograms(toSort, length, layout, hist);
+
+  int *src = toSort, *dest = buffer;
+  for (unsigned p = 0; p < layout.passes; ++p) {
+    size_t *count = &hist[p * layout.buckets];
+    if (radixPassIsTrivial(count, layout.buckets, length))
+      continue;
+
+    // Turn the counts into the start offsets of the buckets.
+    size_t sum = 0;
+    for (size_t d = 0; d < layout.buckets; ++d) {
+      size_t c = count[d];
+      count[d] = sum;
+      sum += c;
+    }
+    radixScatter(src, length, dest, p * layout.bits, layout.buckets, count);
+
+    int *tmp = src;
+    src = dest;
+    dest = tmp;
+  }
+
+  if (src != toSort)
+    memcpy(toSort, src, length * sizeof(int));
+  free(buffer);
+  free(hist);
+  return 0;
+}
+
+/*
+ * State shared by the threads of parallelRadixSort().
+ */
+typedef struct {
+  int *toSort;
+  int *buffer;
+  size_t length;
+  unsigned numThreads;
+  RadixLayout layout;
+  // Per thread and pass digit counts of the thread's chunk, numThreads *
+  // RADIX_MAX_PASSES * buckets counters.
+  size_t *hist;
+  // Whether each pass has to be done, decided from the summed histograms.
+  int doPass[RADIX_MAX_PASSES];
+  pthread_barrier_t barrier;
+  // The threads wait here until all of them are started and numThreads is
+  // final. If setting up fails, they exit right away.
+  pthread_mutex_t gateLock;
+  pthread_cond_t gateOpen;
+  int open;
+  int failed;
+} RadixShared;
+
+typedef struct {
+  RadixShared *shared;
+  unsigned id;
+} RadixThread;
+
+static size_t *radixThreadHist(RadixShared *shared, unsigned id,
+                               unsigned pass) {
+  size_t buckets = shared->layout.buckets;
+  return &shared->hist[(id * RADIX_MAX_PASSES + pass) * buckets];
+}
+
+static void *radixThread(void *arg) {
+  RadixThread *self = arg;
+  RadixShared *shared = self->shared;
+
+  pthread_mutex_lock(&shared->gateLock);
+  while (!shared->open)
+    pthread_cond_wait(&shared->gateOpen, &shared->gateLock);
+  pthread_mutex_unlock(&shared->gateLock);
+  if (shared->failed)
+    return NULL;
+
+  RadixLayout layout = shared->layout;
+  size_t buckets = layout.buckets;
+  unsigned id = self->id, numThreads = shared->numThreads;
+  size_t start = shared->length * id / numThreads;
+  size_t end = shared->length * (id + 1) / numThreads;
+
+  // (1) Histograms of all passes for the own chunk.
+  size_t *own = radixThreadHist(shared, id, 0);
+  radixHistograms(shared->toSort + start, end - start, layout, own);
+  pthread_barrier_wait(&shared->barrier);
+
+  // (2) Thread 0 decides which passes are needed.
+  if (id == 0) {
+    for (unsigned p = 0; p < layout.passes; ++p) {
+      shared->doPass[p] = 0;
+      for (size_t d = 0; d < buckets && !shared->doPass[p]; ++d) {
+        size_t total = 0;
+        for (unsigned t = 0; t < numThreads; ++t)
+          total += radixThreadHist(shared, t, p)[d];
+        shared->doPass[p] = (total != 0) && (total != shared->length);
+      }
+    }
+  }
+  pthread_barrier_wait(&shared->barrier);
+
+  int *src = shared->toSort, *dest = shared->buffer;
+  int first = 1;
+  size_t offsets[RADIX_MAX_BUCKETS];
+  for (unsigned p = 0; p < layout.passes; ++p) {
+    if (!shared->doPass[p])
+      continue;
+    unsigned shift = p * layout.bits;
+
+    // (3) After the first pass, the chunks hold other elements, so the
+    // counts of this pass have to be redone.
+    if (!first) {
+      radixCount(src + start, end - start, shift, buckets,
+                 radixThreadHist(shared, id, p));
+      pthread_barrier_wait(&shared->barrier);
+    }
+    first = 0;
+
+    // (4) The prefix sum over digits, and over threads within a digit,
+    // gives every thread its own region of each bucket. The threads thus
+    // scatter without synchronization and the sort stays stable.
+    size_t sum = 0;
+    for (size_t d = 0; d < buckets; ++d) {
+      for (unsigned t = 0; t < numThreads; ++t) {
+        if (t == id)
+          offsets[d] = sum;
+        sum += radixThreadHist(shared, t, p)[d];
+      }
+    }
+    radixScatter(src + start, end - start, dest, shift, buckets, offsets);
+    pthread_barrier_wait(&shared->barrier);
+
+    int *tmp = src;
+    src = dest;
+    dest = tmp;
+  }
+
+  // (5) Copy the result back if it ended up in the buffer.
+  if (src != shared->toSort)
+    memcpy(shared->toSort + start, src + start, (end - start) * sizeof(int));
+  return NULL;
+}
+
+/**
+ * Sorts the array toSort with given length ascending using LSD radix sort
+ * with numThreads threads, or one per online CPU if numThreads is 0. Every
+ * thread counts and scatters its own chunk of the array.
+ * Returns -1 on error, 0 otherwise.
+ */
+int parallelRadixSort(int *toSort, size_t length, unsigned numThreads) {
+  if (toSort == NULL)
+    return -1;
+  if (numThreads == 0)
+    numThreads = onlineCpus();
+  if (numThreads > length / PARALLEL_MIN_PIECE)
+    numThreads = length / PARALLEL_MIN_PIECE;
+  if (numThreads < 2)
+    return radixSort(toSort, length);
+
+  RadixShared shared = {.toSort = toSort,
+                        .length = length,
+                        .layout = radixLayout(length)};
+  shared.buffer = malloc(length * sizeof(int));
+  shared.hist = malloc(numThreads * RADIX_MAX_PASSES *
+                       shared.layout.buckets * sizeof(size_t));
+  RadixThread *threads = malloc(numThreads * sizeof(RadixThread));
+  pthread_t *handles = malloc(numThreads * sizeof(pthread_t));
+  if (shared.buffer == NULL || shared.hist == NULL || threads == NULL ||
+      handles == NULL) {
+    free(shared.buffer);
+    free(shared.hist);
+    free(threads);
+    free(handles);
+    return -1;
+  }
+  pthread_mutex_init(&shared.gateLock, NULL);
+  pthread_cond_init(&shared.gateOpen, NULL);
+
+  // If not all threads can be started, the sort goes on with fewer.
+  unsigned started = 1;
+  for (; started < numThreads; ++started) {
+    threads[started] = (RadixThread){.shared = &shared, .id = started};
+    if (pthread_create(&handles[started], NULL, radixThread,
+                       &threads[started]) != 0)
+      break;
+  }
+  shared.numThreads = started;
+  shared.failed = pthread_barrier_init(&shared.barrier, NULL, started) != 0;
+
+  pthread_mutex_lock(&shared.gateLock);
+  shared.open = 1;
+  pthread_cond_broadcast(&shared.gateOpen);
+  pthread_mutex_unlock(&shared.gateLock);
+
+  threads[0] = (RadixThread){.shared = &shared, .id = 0};
+  radixThread(&threads[0]);
+  for (unsigned i = 1; i < started; ++i)
+    pthread_join(handles[i], NULL);
+
+  int res = 0;
+  if (shared.failed)
+    res = radixSort(toSort, length);
+  else
+    pthread_barrier_destroy(&shared.barrier);
+
+  pthread_cond_destroy(&shared.gateOpen);
+  pthread_mutex_destroy(&shared.gateLock);
+  free(shared.buffer);
+  free(shared.hist);
+  free(threads);
+  free(handles);
+  return res;
+}
+
+/*
+ * Smallest I/O buffer externalSort() gives a run while merging. With less
+ * memory per run, the runs are merged in several passes.
+ */
+#define EXTERNAL_MIN_BUFFER (64 * 1024)
+
+/*
+ * A sorted run of length ints at byte offset of a temporary file.
+ */
+typedef struct {
+  off_t offset;
+  size_t length;
+} ExternalRun;
+
+/*
+ * Buffered sequential reader of a run.
+ */
+typedef struct {
+  int fd;
+  off_t offset;
+  size_t remaining;
+  int *buffer;
+  size_t capacity;
+  size_t pos;
+  size_t fill;
+} RunReader;
+
+/*
+ * Buffered sequential writer, starting at offset of fd.
+ */
+typedef struct {
+  int fd;
+  off_t offset;
+  int *buffer;
+  size_t capacity;
+  size_t fill;
+} RunWriter;
+
+/*
+ * Reads up to bytes bytes from fd, retrying short reads. Returns the number
+ * of bytes read, which is less than bytes only at the end of the file, or
+ * -1 on error.
+ */
+static ssize_t readFully(int fd, void *buffer, size_t bytes) {
+  size_t done = 0;
+  while (done < bytes) {
+    ssize_t n = read(fd, (char *)buffer + done, bytes - done);
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    done += n;
+  }
+  return done;
+}
+
+/*
+ * Writes bytes bytes to fd at offset. Returns -1 on error, 0 otherwise.
+ */
+static int pwriteFully(int fd, const void *buffer, size_t bytes,
+                       off_t offset) {
+  size_t done = 0;
+  while (done < bytes) {
+    ssize_t n = pwrite(fd, (const char *)buffer + done, bytes - done,
+                       offset + done);
+    if (n <= 0)
+      return -1;
+    done += n;
+  }
+  return 0;
+}
+
+/*
+ * Refills the buffer of reader from its run. Returns -1 on error, 0
+ * otherwise.
+ */
+static int runReaderFill(RunReader *reader) {
+  size_t count = reader->remaining;
+  if (count > reader->capacity)
+    count = reader->capacity;
+  size_t bytes = count * sizeof(int);
+  size_t done = 0;
+  while (done < bytes) {
+    ssize_t n = pread(reader->fd, (char *)reader->buffer + done, bytes - done,
+                      reader->offset + done);
+    if (n <= 0)
+      return -1;
+    done += n;
+  }
+  reader->offset += bytes;
+  reader->remaining -= count;
+  reader->pos = 0;
+  reader->fill = count;
+  return 0;
+}
+
+static int runWriterFlush(RunWriter *writer) {
+  size_t bytes = writer->fill * sizeof(int);
+  if (pwriteFully(writer->fd, writer->buffer, bytes, writer->offset) != 0)
+    return -1;
+  writer->offset += bytes;
+  writer->fill = 0;
+  return 0;
+}
+
+/*
+ * Returns 1 if the head of run a comes before the head of run b. Exhausted
+ * runs come last.
+ */
+static inline int runBeats(const RunReader *readers, size_t a, size_t b) {
+  const RunReader *ra = &readers[a], *rb = &readers[b];
+  if (rb->pos == rb->fill)
+    return 1;
+  if (ra->pos == ra->fill)
+    return 0;
+  return ra->buffer[ra->pos] <= rb->buffer[rb->pos];
+}
+
+/*
+ * Plays the tournament below node of the loser tree over k runs and returns
+ * its winner. Nodes 1...k-1 store the loser of their match, the runs are
+ * the leaves k...2k-1.
+ */
+static size_t loserTreeBuild(size_t *tree, size_t node, size_t k,
+                             const RunReader *readers) {
+  if (node >= k)
+    return node - k;
+  size_t a = loserTreeBuild(tree, 2 * node, k, readers);
+  size_t b = loserTreeBuild(tree, 2 * node + 1, k, readers);
+  if (runBeats(readers, a, b)) {
+    tree[node] = b;
+    return a;
+  }
+  tree[node] = a;
+  return b;
+}
+
+/*
+ * Merges the k runs of inFd into a single run at outOffset of outFd, using
+ * k + 1 buffers of bufferInts ints in memory. The current winner is kept in
+ * tree[0] of a loser tree, so that advancing it only replays the matches on
+ * its path to the root. Returns -1 on error, 0 otherwise.
+ */
+static int mergeExternalRuns(int inFd, const ExternalRun *runs, size_t k,
+                             int outFd, off_t outOffset, int *memory,
+                             size_t bufferInts) {
+  RunReader *readers = malloc(k * sizeof(RunReader));
+  size_t *tree = malloc(k * sizeof(size_t));
+  int res = -1;
+  if (readers == NULL || tree == NULL)
+    goto out;
+  for (size_t i = 0; i < k; ++i) {
+    readers[i] = (RunReader){.fd = inFd,
+                             .offset = runs[i].offset,
+                             .remaining = runs[i].length,
+                             .buffer = memory + i * bufferInts,
+                             .capacity = bufferInts};
+    if (runReaderFill(&readers[i]) != 0)
+      goto out;
+  }
+  RunWriter writer = {.fd = outFd,
+                      .offset = outOffset,
+                      .buffer = memory + k * bufferInts,
+                      .capacity = bufferInts};
+
+  tree[0] = loserTreeBuild(tree, 1, k, readers);
+  for (;;) {
+    size_t winner = tree[0];
+    RunReader *reader = &readers[winner];
+    if (reader->pos == reader->fill)
+      break;
+    writer.buffer[writer.fill++] = reader->buffer[reader->pos++];
+    if (writer.fill == writer.capacity && runWriterFlush(&writer) != 0)
+      goto out;
+    if (reader->pos == reader->fill && reader->remaining > 0 &&
+        runReaderFill(reader) != 0)
+      goto out;
+    for (size_t node = (winner + k) / 2; node > 0; node /= 2) {
+      if (runBeats(readers, tree[node], winner)) {
+        size_t loser = winner;
+        winner = tree[node];
+        tree[node] = loser;
+      }
+    }
+    tree[0] = winner;
+  }
+  res = runWriterFlush(&writer);
+
+out:
+  free(readers);
+  free(tree);
+  return res;
+}
+
+/*
+ * Creates a temporary file next to path. If name is NULL, the file is removed
+ * as soon as it is closed, otherwise its newly allocated name is stored in
+ * *name. Returns its descriptor, or -1 on error.
+ */
+static int openTempFile(const char *path, char **name) {
+  size_t size = strlen(path) + sizeof(".XXXXXX");
+  char *tempName = malloc(size);
+  if (tempName == NULL)
+    return -1;
+  snprintf(tempName, size, "%s.XXXXXX", path);
+  int fd = mkstemp(tempName);
+  if (fd >= 0 && name != NULL) {
+    *name = tempName;
+    return fd;
+  }
+  if (fd >= 0)
+    unlink(tempName);
+  free(tempName);
+  return fd;
+}
+
+/**
+ * Sorts the file inputPath of native ints ascending into outputPath, using
+ * about memoryBytes of memory, so that the input can be larger than the
+ * memory. Memory-sized chunks are sorted with numThreads threads (one per
+ * online CPU if numThreads is 0) and written to a temporary file as runs,
+ * which are then merged with a loser tree. Runs that do not fit into a
+ * single merge are merged in several passes. The result replaces outputPath
+ * only once it is complete, so inputPath and outputPath may be the same file,
+ * and an error leaves both files untouched.
+ * Returns -1 on error, 0 otherwise.
+ */
+int externalSort(const char *inputPath, const char *outputPath,
+                 size_t memoryBytes, unsigned numThreads) {
+  if (inputPath == NULL || outputPath == NULL)
+    return -1;
+  if (memoryBytes < 3 * EXTERNAL_MIN_BUFFER)
+    memoryBytes = 3 * EXTERNAL_MIN_BUFFER;
+  size_t memoryInts = memoryBytes / sizeof(int);
+  // parallelMergeSort() needs a buffer as large as the chunk.
+  size_t chunkInts = memoryInts / 2;
+
+  int res = -1;
+  int inFd = -1, outFd = -1, tempFds[2] = {-1, -1};
+  char *outputTemp = NULL;
+  int *memory = NULL;
+  ExternalRun *runs = NULL;
+  size_t numRuns = 0, runsCapacity = 0;
+
+  inFd = open(inputPath, O_RDONLY);
+  if (inFd < 0)
+    goto out;
+  posix_fadvise(inFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  // Keep the permissions of an existing output file.
+  struct stat outputStat;
+  mode_t mode = 0644;
+  if (stat(outputPath, &outputStat) == 0)
+    mode = outputStat.st_mode & 07777;
+  outFd = openTempFile(outputPath, &outputTemp);
+  if (outFd >= 0 && fchmod(outFd, mode) != 0)
+    goto out;
+  memory = malloc(chunkInts * sizeof(int));
+  if (outFd < 0 || memory == NULL)
+    goto out;
+
+  // (1) Sort memory-sized chunks into runs. If the whole input fits into
+  // one chunk, it goes straight to the output.
+  off_t offset = 0;
+  for (;;) {
+    ssize_t bytes = readFully(inFd, memory, chunkInts * sizeof(int));
+    if (bytes < 0 || bytes % sizeof(int) != 0)
+      goto out;
+    size_t count = bytes / sizeof(int);
+    if (count == 0)
+      break;
+    if (parallelMergeSort(memory, count, numThreads) != 0)
+      goto out;
+    if (numRuns == 0 && count < chunkInts) {
+      res = pwriteFully(outFd, memory, bytes, 0);
+      goto out;
+    }
+    if (tempFds[0] < 0 && (tempFds[0] = openTempFile(outputPath, NULL)) < 0)
+      goto out;
+    if (numRuns == runsCapacity) {
+      runsCapacity = runsCapacity ? 2 * runsCapacity : 16;
+      ExternalRun *moreRuns = realloc(runs, runsCapacity * sizeof(ExternalRun));
+      if (moreRuns == NULL)
+        goto out;
+      runs = moreRuns;
+    }
+    if (pwriteFully(tempFds[0], memory, bytes, offset) != 0)
+      goto out;
+    runs[numRuns++] = (ExternalRun){.offset = offset, .length = count};
+    offset += bytes;
+  }
+
+  // (2) Merge up to fanIn runs at a time, each with a buffer of at least
+  // EXTERNAL_MIN_BUFFER, into the other temporary file, until one merge
+  // into the output is left. The sort buffer is gone now, so the merge gets
+  // all of the memory.
+  int *grown = realloc(memory, memoryInts * sizeof(int));
+  if (grown == NULL)
+    goto out;
+  memory = grown;
+  size_t fanIn = memoryBytes / EXTERNAL_MIN_BUFFER - 1;
+  int src = 0;
+  while (numRuns > 0) {
+    int last = numRuns <= fanIn;
+    if (!last && tempFds[1 - src] < 0 &&
+        (tempFds[1 - src] = openTempFile(outputPath, NULL)) < 0)
+      goto out;
+    int destFd = last ? outFd : tempFds[1 - src];
+    size_t merged = 0;
+    offset = 0;
+    for (size_t first = 0; first < numRuns; first += fanIn) {
+      size_t k = (numRuns - first < fanIn) ? numRuns - first : fanIn;
+      size_t length = 0;
+      for (size_t i = first; i < first + k; ++i)
+        length += runs[i].length;
+      if (mergeExternalRuns(tempFds[src], runs + first, k, destFd, offset,
+                            memory, memoryInts / (k + 1)) != 0)
+        goto out;
+      runs[merged++] = (ExternalRun){.offset = offset, .length = length};
+      offset += length * sizeof(int);
+    }
+    if (last)
+      break;
+    numRuns = merged;
+    src = 1 - src;
+  }
+  res = 0;
+
+out:
+  if (inFd >= 0)
+    close(inFd);
+  if (outFd >= 0 && close(outFd) != 0)
+    res = -1;
+  if (outputTemp != NULL) {
+    if (res == 0 && rename(outputTemp, outputPath) != 0)
+      res = -1;
+    if (res != 0)
+      unlink(outputTemp);
+    free(outputTemp);
+  }
+  for (int i = 0; i < 2; ++i)
+    if (tempFds[i] >= 0)
+      close(tempFds[i]);
+  free(memory);
+  free(runs);
+  return res;
+}
+
 /**
  * Rotates the array stackOfPancakes[0...numberOfPancakesToFlip-1].
  */
@@ -7,4 +7,10 @@
 void insertionSort(int *toSort, size_t length);
 void mergeSort(int *toSort, size_t length);
 void pancakeSort(int *toSort, size_t length);
+void introSort(int *toSort, size_t length);
+int parallelMergeSort(int *toSort, size_t length, unsigned numThreads);
+int radixSort(int *toSort, size_t length);
+int parallelRadixSort(int *toSort, size_t length, unsigned numThreads);
+int externalSort(const char *inputPath, const char *outputPath,
+                 size_t memoryBytes, unsigned numThreads);
 #endif
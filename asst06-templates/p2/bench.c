@@ -0,0 +1,160 @@
+#include "page_table.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Benchmark of the page table. Build with:
+ *   gcc -O2 -o bench bench.c page_table.c -lpthread
+ */
+
+/*
+ * Number of pages the mapping benchmark maps: 1 GiB.
+ */
+#define MAP_PAGES (256 * 1024)
+
+/*
+ * Number of munmap-like operations of the shootdown benchmark, and the
+ * number of pages each of them unmaps.
+ */
+#define UNMAPS 1000
+#define UNMAP_PAGES 16
+
+/*
+ * The CPUs of the shootdown benchmark translate addresses of their own
+ * 4 MiB region from here on. The unmapped pages lie below.
+ */
+#define WORKER_REGION 0x80000000u
+#define SCRATCH_REGION 0x70000000u
+
+static PageDirectory __attribute__((aligned(0x1000))) _pageDirectory;
+
+static int _onlineWorkers;
+static int _stopWorkers;
+static uint64_t _translations[MAX_CPUS];
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Maps MAP_PAGES pages at virtualBase, one mapPage() call per page, or with
+ * a single mapRange() call. Returns the time per page in nanoseconds.
+ */
+static double map_pages(uint32_t virtualBase, int useRange)
+{
+    double start = now_s();
+    if (useRange) {
+        if (mapRange(virtualBase, 0, MAP_PAGES, ACCESS_WRITE, USER_MODE) != 0) {
+            printf("mapRange failed\n");
+        }
+    } else {
+        for (uint32_t i = 0; i < MAP_PAGES; i++) {
+            if (mapPage(virtualBase + (i << OFFSET_BITS), i << OFFSET_BITS,
+                        ACCESS_WRITE, USER_MODE) != 0) {
+                printf("mapPage failed\n");
+                break;
+            }
+        }
+    }
+    return (now_s() - start) * 1e9 / MAP_PAGES;
+}
+
+/*
+ * Translates the addresses of the CPU's own region in a loop, handling
+ * shootdowns between the translations.
+ */
+static void *worker_cpu(void *arg)
+{
+    unsigned cpu = (unsigned)(uintptr_t)arg;
+    cpuOnline(cpu);
+    setPageDirectory(&_pageDirectory);
+    __atomic_add_fetch(&_onlineWorkers, 1, __ATOMIC_RELEASE);
+
+    uint32_t base = WORKER_REGION + (cpu << LARGE_PAGE_BITS);
+    uint64_t count = 0;
+    while (!__atomic_load_n(&_stopWorkers, __ATOMIC_ACQUIRE)) {
+        uint32_t address = base + ((count % 64) << OFFSET_BITS);
+        if (translateTLB(&address, ACCESS_READ, KERNEL_MODE) != 0) {
+            translatePageTable(&address, ACCESS_READ, KERNEL_MODE);
+        }
+        handleTLBShootdowns();
+        count++;
+    }
+    _translations[cpu] = count;
+    cpuOffline();
+    return NULL;
+}
+
+/*
+ * Maps and unmaps UNMAP_PAGES pages UNMAPS times on CPU 0 while
+ * numCpus - 1 other CPUs run worker_cpu(). The shootdowns are sent in
+ * batches of batchSize unmaps.
+ */
+static void bench_shootdown(unsigned numCpus, int batchSize)
+{
+    pthread_t threads[MAX_CPUS];
+    _onlineWorkers = 0;
+    _stopWorkers = 0;
+    for (unsigned c = 1; c < numCpus; c++) {
+        _translations[c] = 0;
+        pthread_create(&threads[c], NULL, worker_cpu, (void *)(uintptr_t)c);
+    }
+    while (__atomic_load_n(&_onlineWorkers, __ATOMIC_ACQUIRE) != (int)numCpus - 1) {
+        sched_yield();
+    }
+
+    long interrupts = 0;
+    double start = now_s();
+    for (int i = 0; i < UNMAPS; i++) {
+        uint32_t address = SCRATCH_REGION + (i % 64) * (UNMAP_PAGES << OFFSET_BITS);
+        mapRange(address, 0, UNMAP_PAGES, ACCESS_WRITE, USER_MODE);
+        unmapRange(address, UNMAP_PAGES);
+        queueTLBShootdown(address, UNMAP_PAGES);
+        if ((i + 1) % batchSize == 0) {
+            interrupts += flushTLBShootdowns();
+        }
+    }
+    interrupts += flushTLBShootdowns();
+    double elapsed = now_s() - start;
+
+    __atomic_store_n(&_stopWorkers, 1, __ATOMIC_RELEASE);
+    uint64_t translations = 0;
+    for (unsigned c = 1; c < numCpus; c++) {
+        pthread_join(threads[c], NULL);
+        translations += _translations[c];
+    }
+    printf("  %u CPUs, batches of %2d: %9.0f ns per unmap, %6ld interrupts, "
+           "%10.0f translations/s on the other CPUs\n",
+           numCpus, batchSize, elapsed * 1e9 / UNMAPS, interrupts,
+           translations / elapsed);
+}
+
+int main()
+{
+    setPageDirectory(&_pageDirectory);
+
+    printf("Mapping %d pages (%d MiB), ns per page\n", MAP_PAGES, MAP_PAGES / 256);
+    printf("  mapPage loop, new page tables:      %8.3f\n", map_pages(0x00000000, 0));
+    printf("  mapRange, new page tables:          %8.3f\n", map_pages(0x40000000, 1));
+    printf("  mapPage loop, existing page tables: %8.3f\n", map_pages(0x00000000, 0));
+    printf("  mapRange, existing page tables:     %8.3f\n", map_pages(0x40000000, 1));
+
+    // The worker regions are mapped before any other CPU comes online, as
+    // only one CPU may change the page tables.
+    mapRange(WORKER_REGION, 0, MAX_CPUS << BITS_PER_ENTRY, ACCESS_READ, KERNEL_MODE);
+    cpuOnline(0);
+    printf("TLB shootdowns, %d unmaps of %d pages\n", UNMAPS, UNMAP_PAGES);
+    unsigned cpuCounts[] = {1, 2, 4};
+    for (unsigned i = 0; i < sizeof(cpuCounts) / sizeof(cpuCounts[0]); i++) {
+        bench_shootdown(cpuCounts[i], 1);
+        bench_shootdown(cpuCounts[i], SHOOTDOWN_BATCH);
+    }
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "testlib.h"
 #include "page_table.h"
+#include <pthread.h>
 #include <stdio.h>
 
 PageDirectory __attribute__((aligned(0x1000))) basePageDirectory;
@@ -7,6 +8,8 @@ PageDirectory __attribute__((aligned(0x1000))) basePageDirectory;
 PageTable __attribute__((aligned(0x1000))) pageTable1;
 // For addresses starting with 0x1000...
 PageTable __attribute__((aligned(0x1000))) pageTable2;
+// A second address space.
+PageDirectory __attribute__((aligned(0x1000))) otherPageDirectory;
 
 #define WRONG_ADDRESS ((uint32_t) -1)
 
@@ -36,6 +39,12 @@ static void _dumpPageDirectory(PageDirectory *dir)
             continue;
         }
 
+        if (dir->entries[i] & PAGE_SIZE_MASK) {
+            printf("%04d => Large page base: 0x%08"PRIx32"\n", i,
+                    (uint32_t)(dir->entries[i] & LARGE_PAGE_BASE_MASK));
+            continue;
+        }
+
         uint64_t address = dir->entries[i] & PAGE_DIRECTORY_ADDRESS_MASK;
 
         printf("%04d => Page table at 0x%016"PRIx64"\n", i, address);
@@ -70,6 +79,29 @@ static uint32_t _doAddressConversion(uint32_t virtual, ReadWrite accessMode,
     }
 }
 
+static int _remoteStep;
+static int _remoteHit;
+
+// Runs as CPU 1: caches a translation, then handles shootdowns until the
+// main thread is done and checks whether the translation is still cached.
+static void *_remoteCpu(void *arg)
+{
+    (void)arg;
+    cpuOnline(1);
+    setPageDirectory(&basePageDirectory);
+    uint32_t address = 0x50005000;
+    translatePageTable(&address, ACCESS_READ, KERNEL_MODE);
+    __atomic_store_n(&_remoteStep, 1, __ATOMIC_RELEASE);
+
+    while (__atomic_load_n(&_remoteStep, __ATOMIC_ACQUIRE) != 2) {
+        handleTLBShootdowns();
+    }
+    address = 0x50005000;
+    _remoteHit = (translateTLB(&address, ACCESS_READ, KERNEL_MODE) == 0);
+    cpuOffline();
+    return NULL;
+}
+
 int main()
 {
     test_start("page_table.c");
@@ -173,6 +205,171 @@ int main()
     test_equals_int(_doAddressConversion(0x01004abc, ACCESS_WRITE, USER_MODE), 0x02004abc,
             "write access to 0x01004abc in user-mode");
 
+    // Address space identifiers
+    setPageDirectoryAsid(&basePageDirectory, 1);
+    test_equals_int(_doAddressConversion(0x00003000, ACCESS_READ, KERNEL_MODE), 0x02003000,
+            "read access to 0x00003000 in address space 1");
+    setPageDirectoryAsid(&otherPageDirectory, 2);
+    mapPage(0x00003000, 0x04003000, ACCESS_READ, USER_MODE);
+    uint32_t address = 0x00003000;
+    test_equals_int(translateTLB(&address, ACCESS_READ, KERNEL_MODE), -1,
+            "the translation of address space 1 does not match in address space 2");
+    test_equals_int(_doAddressConversion(0x00003000, ACCESS_READ, KERNEL_MODE), 0x04003000,
+            "read access to 0x00003000 in address space 2");
+    setPageDirectoryAsid(&basePageDirectory, 1);
+    address = 0x00003000;
+    test_assert((translateTLB(&address, ACCESS_READ, KERNEL_MODE) == 0) && (address == 0x02003000),
+            "switching back to address space 1 keeps its translation cached");
+    invalidateTLBAsid(1);
+    address = 0x00003000;
+    test_equals_int(translateTLB(&address, ACCESS_READ, KERNEL_MODE), -1,
+            "invalidateTLBAsid removes the translations of address space 1");
+    setPageDirectoryAsid(&otherPageDirectory, 2);
+    address = 0x00003000;
+    test_assert((translateTLB(&address, ACCESS_READ, KERNEL_MODE) == 0) && (address == 0x04003000),
+            "invalidateTLBAsid keeps the translations of address space 2");
+    setPageDirectory(&basePageDirectory);
+
+    // Large pages
+    test_equals_int(mapLargePage(0x40000000, 0x08000000, ACCESS_WRITE, USER_MODE), 0,
+            "map a large page");
+    test_equals_int(mapLargePage(0x80001000, 0x08000000, ACCESS_WRITE, USER_MODE), -1,
+            "large pages must be 4 MiB aligned");
+    test_equals_int(mapLargePage(0x00000000, 0x08000000, ACCESS_WRITE, USER_MODE), -1,
+            "large pages cannot replace a page table");
+    test_equals_int(mapPage(0x40001000, 0x02000000, ACCESS_WRITE, USER_MODE), -1,
+            "small pages cannot be mapped inside a large page");
+    test_equals_int(_doAddressConversion(0x40123456, ACCESS_WRITE, USER_MODE), 0x08123456,
+            "write access to 0x40123456 in user-mode (large page)");
+    test_equals_int(basePageDirectory.entries[0x40000000 >> LARGE_PAGE_BITS] & PAGE_ACCESSED_MASK,
+            PAGE_ACCESSED_MASK, "The access bit of the large page is set");
+    address = 0x403ffffc;
+    test_assert((translateTLB(&address, ACCESS_READ, USER_MODE) == 0) && (address == 0x083ffffc),
+            "a single TLB entry covers the whole large page");
+    invalidateTLBEntry(0x40200000);
+    address = 0x40000000;
+    test_equals_int(translateTLB(&address, ACCESS_READ, USER_MODE), -1,
+            "invalidating a page inside the large page removes its TLB entry");
+    mapLargePage(0x40400000, 0x08400000, ACCESS_READ, KERNEL_MODE);
+    test_equals_int(_doAddressConversion(0x40400000, ACCESS_READ, USER_MODE), -1,
+            "read access to the kernel large page 0x40400000 in user-mode");
+    test_equals_int(_doAddressConversion(0x407fffff, ACCESS_READ, KERNEL_MODE), 0x087fffff,
+            "read access to 0x407fffff in kernel-mode (large page)");
+
+    // Ranges
+    test_equals_int(mapRange(0x50003000, 0x06000000, 2050, ACCESS_WRITE, USER_MODE), 0,
+            "map a range of 2050 pages over three page tables");
+    test_equals_int(_doAddressConversion(0x50003010, ACCESS_WRITE, USER_MODE), 0x06000010,
+            "write access to the first page of the range");
+    test_equals_int(_doAddressConversion(0x503ff000, ACCESS_WRITE, USER_MODE), 0x063fc000,
+            "write access to the last page of the first page table of the range");
+    test_equals_int(_doAddressConversion(0x50400000, ACCESS_READ, USER_MODE), 0x063fd000,
+            "read access to the first page of the second page table of the range");
+    test_equals_int(_doAddressConversion(0x50804fff, ACCESS_READ, USER_MODE), 0x06801fff,
+            "read access to the last page of the range");
+    test_equals_int(_doAddressConversion(0x50805000, ACCESS_READ, USER_MODE), -1,
+            "read access behind the range");
+    test_equals_int(_doAddressConversion(0x50002000, ACCESS_READ, USER_MODE), -1,
+            "read access before the range");
+    test_equals_int(mapRange(0x50400000, 0x07000000, 2, ACCESS_READ, KERNEL_MODE), 0,
+            "map a range over mapped pages");
+    test_equals_int(_doAddressConversion(0x50400000, ACCESS_READ, KERNEL_MODE), 0x07000000,
+            "read access to a remapped page (not from TLB)");
+    test_equals_int(_doAddressConversion(0x50401000, ACCESS_READ, USER_MODE), -1,
+            "read access to a remapped kernel page in user-mode");
+    test_equals_int(_doAddressConversion(0x50402000, ACCESS_READ, USER_MODE), 0x063ff000,
+            "read access to the page behind the remapped ones");
+    test_equals_int(mapRange(0x403fe000, 0x07000000, 4, ACCESS_READ, USER_MODE), -1,
+            "ranges cannot overlap large pages");
+    test_equals_int(mapRange(0xfffff000, 0x07000000, 2, ACCESS_READ, USER_MODE), -1,
+            "ranges cannot wrap around the address space");
+    test_equals_int(mapRange(0x60000800, 0x07000000, 2, ACCESS_READ, USER_MODE), -1,
+            "ranges must be page aligned");
+
+    // Range invalidation
+    flushTLB();
+    _doAddressConversion(0x50003000, ACCESS_READ, KERNEL_MODE);
+    _doAddressConversion(0x50004000, ACCESS_READ, KERNEL_MODE);
+    invalidateTLBRange(0x50003000, 1);
+    address = 0x50003000;
+    test_equals_int(translateTLB(&address, ACCESS_READ, KERNEL_MODE), -1,
+            "invalidateTLBRange removes the pages in the range");
+    address = 0x50004000;
+    test_equals_int(translateTLB(&address, ACCESS_READ, KERNEL_MODE), 0,
+            "invalidateTLBRange keeps the pages behind the range");
+    invalidateTLBRange(0x60000000, TLB_FLUSH_CEILING + 1);
+    address = 0x50004000;
+    test_equals_int(translateTLB(&address, ACCESS_READ, KERNEL_MODE), -1,
+            "a range longer than TLB_FLUSH_CEILING flushes the address space");
+    _doAddressConversion(0x50004000, ACCESS_READ, KERNEL_MODE);
+    test_equals_int(unmapRange(0x50003000, 2), 0, "unmap two pages");
+    test_equals_int(_doAddressConversion(0x50004000, ACCESS_READ, KERNEL_MODE), -1,
+            "read access to an unmapped page");
+    test_equals_int(_doAddressConversion(0x50005000, ACCESS_READ, KERNEL_MODE), 0x06002000,
+            "read access to the page behind the unmapped ones");
+    test_equals_int(unmapRange(0x40000000, 1), -1, "large pages cannot be unmapped by page");
+
+    // Shootdowns
+    test_equals_int(cpuOnline(0), 0, "the main thread goes online as CPU 0");
+    test_equals_int(cpuOnline(MAX_CPUS), -1, "there are only MAX_CPUS CPUs");
+    pthread_t remote;
+    pthread_create(&remote, NULL, _remoteCpu, NULL);
+    while (__atomic_load_n(&_remoteStep, __ATOMIC_ACQUIRE) != 1) {
+    }
+    queueTLBShootdown(0x50005000, 1);
+    queueTLBShootdown(0x50006000, 1);
+    test_equals_int(flushTLBShootdowns(), 1, "a batch of two ranges interrupts the other CPU once");
+    test_equals_int(flushTLBShootdowns(), 0, "an empty batch interrupts no CPU");
+    __atomic_store_n(&_remoteStep, 2, __ATOMIC_RELEASE);
+    pthread_join(remote, NULL);
+    test_equals_int(_remoteHit, 0, "the shootdown removed the translation from the other CPU");
+    cpuOffline();
+    setPageDirectory(&basePageDirectory);
+
+    // PDE cache: the walk takes the page directory entry from the cache, even
+    // if the page directory changed, until the entry is invalidated.
+    flushTLB();
+    test_equals_int(_doAddressConversion(0x00000000, ACCESS_READ, KERNEL_MODE), 0x02000000,
+            "read access to 0x00000000 caches its page directory entry");
+    uint64_t pde = basePageDirectory.entries[0];
+    basePageDirectory.entries[0] = 0;
+    test_equals_int(_doAddressConversion(0x00002000, ACCESS_READ, KERNEL_MODE), 0x02002000,
+            "read access to 0x00002000 walks the page table through the PDE cache");
+    invalidateTLBEntry(0x00003000);
+    test_equals_int(_doAddressConversion(0x00003000, ACCESS_READ, KERNEL_MODE), -1,
+            "invalidateTLBEntry removes the cached page directory entry");
+    basePageDirectory.entries[0] = pde;
+    test_equals_int(_doAddressConversion(0x00003000, ACCESS_READ, KERNEL_MODE), 0x02003000,
+            "read access to 0x00003000 with the restored page directory entry");
+
+    // Statistics
+    PageTableStats stats;
+    enablePageTableStats(1);
+    resetPageTableStats();
+    flushTLB();
+    mapPage(0x7f000000, 0x03000000, ACCESS_READ, USER_MODE);
+    _doAddressConversion(0x7f000000, ACCESS_READ, USER_MODE);
+    _doAddressConversion(0x7f000000, ACCESS_READ, USER_MODE);
+    _doAddressConversion(0x7f000000, ACCESS_WRITE, USER_MODE);
+    _doAddressConversion(0x7f001000, ACCESS_READ, USER_MODE);
+    enablePageTableStats(0);
+    _doAddressConversion(0x7f000000, ACCESS_READ, USER_MODE);
+    getPageTableStats(&stats);
+    dumpPageTableStats(stdout);
+    test_equals_int64(stats.tlbHits, 2, "two lookups hit the TLB");
+    test_equals_int64(stats.tlbMisses, 2, "two lookups missed the TLB");
+    test_equals_int64(stats.tlbEvictions, 0, "no TLB entry was evicted");
+    test_equals_int64(stats.pageWalks, 3, "three accesses walked the page table");
+    test_equals_int64(stats.pdeCacheHits, 2, "two walks hit the PDE cache");
+    test_equals_int64(stats.accessedBitsSet, 1, "the first access set the accessed bit");
+    test_equals_int64(stats.notPresentFaults, 1, "one access faulted on a missing page");
+    test_equals_int64(stats.protectionFaults, 1, "one access faulted on a read-only page");
+    test_equals_int64(stats.pageTablesAllocated, 1, "mapPage allocated one page table");
+    test_equals_int64(stats.pagesMapped, 1, "mapPage mapped one page");
+    resetPageTableStats();
+    getPageTableStats(&stats);
+    test_equals_int64(stats.tlbHits + stats.pageWalks, 0, "resetPageTableStats clears the counters");
+
     _dumpPageDirectory(&basePageDirectory);
 
     return test_end();
@@ -1,16 +1,22 @@
 #define _POSIX_C_SOURCE 200112L
 #include "page_table.h"
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 
-// The pointer to the base directory.
-// You can safely assume that this is set before any address conversion is done.
-static PageDirectory *_cr3 = NULL;
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The pool allocates page tables in blocks of at least this many tables.
+#define PAGE_TABLE_POOL_CHUNK 64
 
 typedef struct {
   uint32_t accessCounter;
   int valid;
+  uint16_t asid;
 
   uint32_t virtualBase; // This is the TLB tag: the virtual base address.
   uint32_t pte;         // The page table entry. The accessed bit is ignored.
@@ -21,44 +27,272 @@ typedef struct {
   uint32_t accessCounter;
 } TLB;
 
-// This is reset to all 0.
-static TLB _tlb;
+// A cached page directory entry that points to a page table. Entries of
+// large pages are cached in the TLB instead.
+typedef struct {
+  uint32_t accessCounter;
+  int valid;
+  uint16_t asid;
+
+  uint32_t pdi; // The index in the page directory.
+  uint64_t pde;
+} PDECacheEntry;
+
+typedef struct {
+  PDECacheEntry entries[PDE_CACHE_SIZE];
+  uint32_t accessCounter;
+} PDECache;
+
+// A range to invalidate in a shootdown.
+typedef struct {
+  uint32_t virtualBase;
+  uint32_t numPages;
+  uint16_t asid;
+} ShootdownRange;
+
+// Invalidations waiting to be sent or handled. If more ranges come in than
+// fit, the whole TLB is flushed instead.
+typedef struct {
+  ShootdownRange ranges[SHOOTDOWN_BATCH];
+  int count;
+  int flushAll;
+} ShootdownBatch;
+
+// The state of a simulated CPU.
+typedef struct {
+  // The pointer to the base directory.
+  // You can safely assume that this is set before any address conversion
+  // is done.
+  PageDirectory *cr3;
+
+  // Address space of the current page directory. TLB entries of other
+  // address spaces stay cached, but never match.
+  uint16_t asid;
+
+  // This is reset to all 0.
+  TLB tlb;
+
+  // The PDE cache is flushed and invalidated together with the TLB.
+  PDECache pdeCache;
+
+  // Invalidations queued by this CPU for the others.
+  ShootdownBatch outgoing;
+
+  // Protected by _shootdownLock: whether the CPU takes part in shootdowns,
+  // the invalidations sent to it, and the number of shootdowns sent to it.
+  int online;
+  ShootdownBatch incoming;
+  uint64_t requested;
+
+  // The number of shootdowns the CPU has handled, read by the senders.
+  uint64_t handled;
+
+  // Only updated while _statsEnabled is set.
+  PageTableStats stats;
+} Cpu;
+
+static Cpu _cpus[MAX_CPUS];
+
+// The CPU the calling thread runs on.
+static __thread Cpu *_cpu = &_cpus[0];
+
+static int _statsEnabled = 0;
+
+// Adds count to the statistics counter field of the current CPU if the
+// statistics are enabled.
+#define _countStat(field, count)                                             \
+  do {                                                                       \
+    if (__builtin_expect(__atomic_load_n(&_statsEnabled, __ATOMIC_RELAXED),  \
+                         0)) {                                               \
+      _cpu->stats.field += (count);                                          \
+    }                                                                        \
+  } while (0)
+
+static pthread_mutex_t _shootdownLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Page tables that have been allocated, but not handed out yet. They are
+// linked through their first bytes.
+static PageTable *_freePageTables = NULL;
+static size_t _numFreePageTables = 0;
 
 void setPageDirectory(PageDirectory *directory) {
-  _cr3 = directory;
+  _cpu->cr3 = directory;
+  _cpu->asid = 0;
   flushTLB();
 }
 
-void flushTLB() { memset(&_tlb, 0, sizeof(_tlb)); }
+void setPageDirectoryAsid(PageDirectory *directory, uint16_t asid) {
+  // No flush: the entries of the new address space may still be cached from
+  // the last time it ran.
+  _cpu->cr3 = directory;
+  _cpu->asid = asid;
+}
+
+void invalidateTLBAsid(uint16_t asid) {
+  for (int i = 0; i < TLB_SIZE; i++) {
+    if (_cpu->tlb.entries[i].asid == asid) {
+      _cpu->tlb.entries[i].valid = 0;
+    }
+  }
+  for (int i = 0; i < PDE_CACHE_SIZE; i++) {
+    if (_cpu->pdeCache.entries[i].asid == asid) {
+      _cpu->pdeCache.entries[i].valid = 0;
+    }
+  }
+}
+
+// Returns 1 if the TLB entry holds a translation of virtualBase in address
+// space asid, 0 otherwise. An entry of a large page matches every page
+// inside of it.
+static int _tlbEntryMatches(const TLBEntry *entry, uint32_t virtualBase,
+                            uint16_t asid) {
+  if (entry->pte & PAGE_SIZE_MASK) {
+    virtualBase &= LARGE_PAGE_BASE_MASK;
+  }
+  return entry->valid && (entry->virtualBase == virtualBase) &&
+         (entry->asid == asid);
+}
+
+void flushTLB() {
+  memset(&_cpu->tlb, 0, sizeof(_cpu->tlb));
+  memset(&_cpu->pdeCache, 0, sizeof(_cpu->pdeCache));
+}
+
+// Returns the cache entry of page directory index pdi in address space
+// asid, or NULL.
+static PDECacheEntry *_findCachedPde(uint32_t pdi, uint16_t asid) {
+  for (int i = 0; i < PDE_CACHE_SIZE; i++) {
+    PDECacheEntry *entry = &_cpu->pdeCache.entries[i];
+    if (entry->valid && (entry->pdi == pdi) && (entry->asid == asid)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Returns the page directory entry pdi as the MMU sees it: from the PDE
+// cache if it is cached there, otherwise from the page directory. Entries
+// that point to a page table are then cached, replacing the least recently
+// used one.
+static uint64_t _loadPde(uint32_t pdi) {
+  PDECacheEntry *entry = _findCachedPde(pdi, _cpu->asid);
+  if (entry == NULL) {
+    uint64_t pde = _cpu->cr3->entries[pdi];
+    if (!(pde & PAGE_PRESENT_MASK) || (pde & PAGE_SIZE_MASK)) {
+      return pde;
+    }
+
+    entry = &_cpu->pdeCache.entries[0];
+    for (int i = 1; i < PDE_CACHE_SIZE && entry->valid; i++) {
+      if (!_cpu->pdeCache.entries[i].valid ||
+          (_cpu->pdeCache.entries[i].accessCounter < entry->accessCounter)) {
+        entry = &_cpu->pdeCache.entries[i];
+      }
+    }
+    entry->valid = 1;
+    entry->asid = _cpu->asid;
+    entry->pdi = pdi;
+    entry->pde = pde;
+  }
+
+  entry->accessCounter = _cpu->pdeCache.accessCounter++;
+  return entry->pde;
+}
+
+// Removes page directory index pdi of address space asid from the PDE
+// cache.
+static void _invalidateCachedPde(uint32_t pdi, uint16_t asid) {
+  PDECacheEntry *entry = _findCachedPde(pdi, asid);
+  if (entry != NULL) {
+    entry->valid = 0;
+  }
+}
+
+// Returns the slot of virtualBase in the page table pde points to.
+static uint32_t *_getPteSlot(uint64_t pde, uint32_t virtualBase) {
+  uint64_t pageTableAddress = pde & PAGE_DIRECTORY_ADDRESS_MASK;
+  PageTable *pageTable = (PageTable *)intToPointer(pageTableAddress);
+
+  uint32_t pti = _getPageTableIndex(virtualBase);
+  assert(pti < ENTRIES_PER_TABLE);
+
+  return &pageTable->entries[pti];
+}
+
+// Makes sure that the pool holds at least count page tables. Missing ones
+// are allocated in a single aligned block. Returns -1 on error, 0 otherwise.
+static int _reservePageTables(size_t count) {
+  if (_numFreePageTables >= count) {
+    return 0;
+  }
+
+  size_t missing = count - _numFreePageTables;
+  if (missing < PAGE_TABLE_POOL_CHUNK) {
+    missing = PAGE_TABLE_POOL_CHUNK;
+  }
+
+  PageTable *block = NULL;
+  if (posix_memalign((void **)&block, sizeof(PageTable),
+                     missing * sizeof(PageTable)) != 0) {
+    return -1;
+  }
+
+  // Push in reverse, so that the tables are handed out in address order.
+  for (size_t i = missing; i > 0; i--) {
+    memcpy(&block[i - 1], &_freePageTables, sizeof(PageTable *));
+    _freePageTables = &block[i - 1];
+  }
+  _numFreePageTables += missing;
+  return 0;
+}
+
+// Takes a page table from the pool and registers it at index pdi of the page
+// directory. If clear is 0, the caller sets all of its entries. Returns NULL
+// if no page table can be allocated.
+static PageTable *_installPageTable(uint32_t pdi, int clear) {
+  if (_reservePageTables(1) != 0) {
+    return NULL;
+  }
+
+  PageTable *pageTable = _freePageTables;
+  memcpy(&_freePageTables, pageTable, sizeof(PageTable *));
+  _numFreePageTables--;
+
+  if (clear) {
+    memset(pageTable, 0, sizeof(PageTable));
+  }
+
+  // Register the new page table in the page directory.
+  uint64_t address = pointerToInt(pageTable);
+  assert((address & OFFSET_MASK) == 0);
+
+  _cpu->cr3->entries[pdi] = address | PAGE_PRESENT_MASK;
+  _invalidateCachedPde(pdi, _cpu->asid);
+  _countStat(pageTablesAllocated, 1);
+  return pageTable;
+}
 
 // Sets the page table entry, allocates a new table if required.
 int _setPte(uint32_t virtualBase, uint32_t pte) {
-  assert(_cr3 != NULL);
+  assert(_cpu->cr3 != NULL);
   assert(_getOffset(virtualBase) == 0);
 
   // (1) Get the page table from the given address
   uint32_t pdi = _getPageDirectoryIndex(virtualBase);
   assert(pdi < ENTRIES_PER_TABLE);
 
-  uint64_t pde = _cr3->entries[pdi];
+  uint64_t pde = _cpu->cr3->entries[pdi];
   PageTable *pageTable = NULL;
-  if (!(pde & PAGE_PRESENT_MASK)) {
-    // The page table has not been allocated yet. Allocate a new,
-    // aligned one and clear it to reset all present bits in the PTEs.
-    if (posix_memalign((void **)&pageTable, sizeof(PageTable),
-                       sizeof(PageTable)) != 0) {
+  if (pde & PAGE_SIZE_MASK) {
+    // The range is mapped by a large page.
+    return -1;
+  } else if (!(pde & PAGE_PRESENT_MASK)) {
+    // The page table has not been allocated yet. Take a new one from the
+    // pool, cleared to reset all present bits in the PTEs.
+    pageTable = _installPageTable(pdi, 1);
+    if (pageTable == NULL) {
       return -1;
     }
-
-    assert(pageTable != NULL);
-    memset(pageTable, 0, sizeof(PageTable));
-
-    // Register the new page table in the page directory.
-    uint64_t address = pointerToInt(pageTable);
-    assert((address & OFFSET_MASK) == 0);
-
-    pde = address | PAGE_PRESENT_MASK;
-    _cr3->entries[pdi] = pde;
   } else {
     uint64_t pageTableAddress = pde & PAGE_DIRECTORY_ADDRESS_MASK;
     pageTable = (PageTable *)intToPointer(pageTableAddress);
@@ -73,56 +307,221 @@ int _setPte(uint32_t virtualBase, uint32_t pte) {
   return 0;
 }
 
-// Gets the entry in the page table or 0 if there is no entry yet.
+// Gets the entry in the page table or 0 if there is no entry yet. For a
+// large page, this is the page directory entry, which has the page size bit
+// set. The page directory entry is taken from the PDE cache if possible.
 uint32_t _getPte(uint32_t virtualBase) {
-  assert(_cr3 != NULL);
+  assert(_cpu->cr3 != NULL);
   assert(_getOffset(virtualBase) == 0);
 
   // (1) Get the page table from the given address
   uint32_t pdi = _getPageDirectoryIndex(virtualBase);
   assert(pdi < ENTRIES_PER_TABLE);
 
-  uint64_t pde = _cr3->entries[pdi];
+  uint64_t pde = _loadPde(pdi);
   if (!(pde & PAGE_PRESENT_MASK)) {
     // The page table is not allocated. We return 0 as an PTE, which will
     // have the present bit cleared.
     return 0;
   }
 
-  uint64_t pageTableAddress = pde & PAGE_DIRECTORY_ADDRESS_MASK;
-  PageTable *pageTable = (PageTable *)intToPointer(pageTableAddress);
+  if (pde & PAGE_SIZE_MASK) {
+    // Large page entries fit into 32 bits.
+    return (uint32_t)pde;
+  }
 
   // (2) Get and return the PTE
-  uint32_t pti = _getPageTableIndex(virtualBase);
-  assert(pti < ENTRIES_PER_TABLE);
+  return *_getPteSlot(pde, virtualBase);
+}
+
+// Returns the bits of a page table entry that grant the access rights.
+static uint32_t _permissionBits(ReadWrite accessMode,
+                                PrivilegeLevel privileges) {
+  uint32_t bits = 0;
 
-  return pageTable->entries[pti];
+  if (accessMode == ACCESS_WRITE) {
+    bits |= PAGE_READWRITE_MASK;
+  }
+
+  if (privileges == USER_MODE) {
+    bits |= PAGE_USERMODE_MASK;
+  }
+
+  return bits;
 }
 
-int mapPage(uint32_t virtualBase, uint32_t physicalBase, ReadWrite accessMode,
-            PrivilegeLevel privileges) {
+// Writes count consecutive page table entries, starting with pte and
+// advancing the physical base by one page each.
+static void _fillPtes(uint32_t *entries, uint32_t count, uint32_t pte) {
+  uint32_t i = 0;
+#ifdef __SSE2__
+  const uint32_t page = 1 << OFFSET_BITS;
+  __m128i ptes = _mm_setr_epi32(pte, pte + page, pte + 2 * page, pte + 3 * page);
+  __m128i step = _mm_set1_epi32(4 * page);
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_si128((__m128i *)&entries[i], ptes);
+    ptes = _mm_add_epi32(ptes, step);
+  }
+  pte += i << OFFSET_BITS;
+#endif
+  for (; i < count; i++) {
+    entries[i] = pte;
+    pte += 1 << OFFSET_BITS;
+  }
+}
+
+int mapRange(uint32_t virtualBase, uint32_t physicalBase, uint32_t numPages,
+             ReadWrite accessMode, PrivilegeLevel privileges) {
+  assert(_cpu->cr3 != NULL);
   if ((_getOffset(virtualBase) != 0) || (_getOffset(physicalBase) != 0)) {
     return -1;
   }
 
-  // Build the page table entry from the physical base and flags
-  uint32_t pte = physicalBase | PAGE_PRESENT_MASK;
+  uint64_t end = (uint64_t)virtualBase + ((uint64_t)numPages << OFFSET_BITS);
+  if ((end > (1ULL << 32)) ||
+      ((uint64_t)physicalBase + ((uint64_t)numPages << OFFSET_BITS) >
+       (1ULL << 32))) {
+    return -1;
+  }
+  if (numPages == 0) {
+    return 0;
+  }
 
-  if (accessMode == ACCESS_WRITE) {
-    pte |= PAGE_READWRITE_MASK;
+  // (1) Check that no large page is in the way and get all missing page
+  // tables at once, so that the range is either mapped completely or not
+  // at all.
+  uint32_t firstPdi = _getPageDirectoryIndex(virtualBase);
+  uint32_t lastPdi = _getPageDirectoryIndex((uint32_t)(end - 1));
+  size_t missing = 0;
+  for (uint32_t pdi = firstPdi; pdi <= lastPdi; pdi++) {
+    uint64_t pde = _cpu->cr3->entries[pdi];
+    if (pde & PAGE_SIZE_MASK) {
+      return -1;
+    }
+    missing += !(pde & PAGE_PRESENT_MASK);
+  }
+  if (_reservePageTables(missing) != 0) {
+    return -1;
   }
 
-  if (privileges == USER_MODE) {
-    pte |= PAGE_USERMODE_MASK;
+  // (2) Fill the entries one page table at a time. New tables that the
+  // range covers completely do not need to be cleared.
+  uint32_t pte =
+      physicalBase | _permissionBits(accessMode, privileges) | PAGE_PRESENT_MASK;
+  uint32_t address = virtualBase;
+  uint32_t remaining = numPages;
+  for (uint32_t pdi = firstPdi; pdi <= lastPdi; pdi++) {
+    uint32_t pti = _getPageTableIndex(address);
+    uint32_t count = ENTRIES_PER_TABLE - pti;
+    if (count > remaining) {
+      count = remaining;
+    }
+
+    uint64_t pde = _cpu->cr3->entries[pdi];
+    PageTable *pageTable;
+    if (pde & PAGE_PRESENT_MASK) {
+      pageTable = (PageTable *)intToPointer(pde & PAGE_DIRECTORY_ADDRESS_MASK);
+    } else {
+      pageTable = _installPageTable(pdi, count != ENTRIES_PER_TABLE);
+      assert(pageTable != NULL);
+    }
+
+    _fillPtes(&pageTable->entries[pti], count, pte);
+    pte += count << OFFSET_BITS;
+    address += count << OFFSET_BITS;
+    remaining -= count;
+  }
+
+  _countStat(pagesMapped, numPages);
+  invalidateTLBRange(virtualBase, numPages);
+  return 0;
+}
+
+int unmapRange(uint32_t virtualBase, uint32_t numPages) {
+  assert(_cpu->cr3 != NULL);
+  if (_getOffset(virtualBase) != 0) {
+    return -1;
+  }
+
+  uint64_t end = (uint64_t)virtualBase + ((uint64_t)numPages << OFFSET_BITS);
+  if (end > (1ULL << 32)) {
+    return -1;
+  }
+  if (numPages == 0) {
+    return 0;
+  }
+
+  uint32_t firstPdi = _getPageDirectoryIndex(virtualBase);
+  uint32_t lastPdi = _getPageDirectoryIndex((uint32_t)(end - 1));
+  for (uint32_t pdi = firstPdi; pdi <= lastPdi; pdi++) {
+    if (_cpu->cr3->entries[pdi] & PAGE_SIZE_MASK) {
+      return -1;
+    }
   }
 
+  // Clear the entries one page table at a time. Page tables are kept.
+  uint32_t address = virtualBase;
+  uint32_t remaining = numPages;
+  for (uint32_t pdi = firstPdi; pdi <= lastPdi; pdi++) {
+    uint32_t pti = _getPageTableIndex(address);
+    uint32_t count = ENTRIES_PER_TABLE - pti;
+    if (count > remaining) {
+      count = remaining;
+    }
+
+    uint64_t pde = _cpu->cr3->entries[pdi];
+    if (pde & PAGE_PRESENT_MASK) {
+      memset(_getPteSlot(pde, address), 0, count * sizeof(uint32_t));
+    }
+    address += count << OFFSET_BITS;
+    remaining -= count;
+  }
+
+  invalidateTLBRange(virtualBase, numPages);
+  return 0;
+}
+
+int mapPage(uint32_t virtualBase, uint32_t physicalBase, ReadWrite accessMode,
+            PrivilegeLevel privileges) {
+  if ((_getOffset(virtualBase) != 0) || (_getOffset(physicalBase) != 0)) {
+    return -1;
+  }
+
+  // Build the page table entry from the physical base and flags
+  uint32_t pte =
+      physicalBase | _permissionBits(accessMode, privileges) | PAGE_PRESENT_MASK;
+
   // Set the new PTE and invalidate any cached version in the TLB
   int res = _setPte(virtualBase, pte);
   invalidateTLBEntry(virtualBase);
+  _countStat(pagesMapped, res == 0);
 
   return res;
 }
 
+int mapLargePage(uint32_t virtualBase, uint32_t physicalBase,
+                 ReadWrite accessMode, PrivilegeLevel privileges) {
+  assert(_cpu->cr3 != NULL);
+  if ((virtualBase & LARGE_PAGE_OFFSET_MASK) ||
+      (physicalBase & LARGE_PAGE_OFFSET_MASK)) {
+    return -1;
+  }
+
+  uint32_t pdi = _getPageDirectoryIndex(virtualBase);
+  uint64_t pde = _cpu->cr3->entries[pdi];
+  if ((pde & PAGE_PRESENT_MASK) && !(pde & PAGE_SIZE_MASK)) {
+    return -1; // The range is mapped with a page table.
+  }
+
+  pde = physicalBase | _permissionBits(accessMode, privileges) |
+        PAGE_SIZE_MASK | PAGE_PRESENT_MASK;
+  _cpu->cr3->entries[pdi] = pde;
+  invalidateTLBEntry(virtualBase);
+  _countStat(largePagesMapped, 1);
+
+  return 0;
+}
+
 static int _translateByEntry(uint32_t *address, ReadWrite accessMode,
                              PrivilegeLevel privileges, uint32_t pte) {
   assert(address != NULL);
@@ -139,7 +538,9 @@ static int _translateByEntry(uint32_t *address, ReadWrite accessMode,
     }
   }
 
-  *address = (pte & PAGE_TABLE_ADDRESS_MASK) + _getOffset(*address);
+  uint32_t offsetMask =
+      (pte & PAGE_SIZE_MASK) ? LARGE_PAGE_OFFSET_MASK : OFFSET_MASK;
+  *address = (pte & ~offsetMask) + (*address & offsetMask);
   return 0;
 }
 
@@ -162,10 +563,14 @@ int translatePageTable(uint32_t *address, ReadWrite accessMode,
   }
 
   uint32_t vab = _getVirtualBase(*address);
+  _countStat(pageWalks, 1);
+  _countStat(pdeCacheHits,
+             _findCachedPde(_getPageDirectoryIndex(vab), _cpu->asid) != NULL);
   uint32_t pte = _getPte(vab);
 
   if (!(pte & PAGE_PRESENT_MASK)) {
     // Page Fault. Reason: Not present
+    _countStat(notPresentFaults, 1);
     if (handlePageFault(vab, pte) <= 0) {
       return -1;
     }
@@ -177,58 +582,106 @@ int translatePageTable(uint32_t *address, ReadWrite accessMode,
 
   // TLB add policy: Only add to TLB if page access is allowed.
   if (_translateByEntry(address, accessMode, privileges, pte) == 0) {
-    int r = addToTLB(vab, pte);
-    assert(r == 0);
-
-    pte |= PAGE_ACCESSED_MASK;
-    return _setPte(vab, pte);
+    // A large page takes a single TLB entry for all of its 4 MiB.
+    uint32_t pdi = _getPageDirectoryIndex(vab);
+    if (pte & PAGE_SIZE_MASK) {
+      int r = addToTLB(vab & LARGE_PAGE_BASE_MASK, pte);
+      assert(r == 0);
+
+      _countStat(accessedBitsSet, !(pte & PAGE_ACCESSED_MASK));
+      _cpu->cr3->entries[pdi] |= PAGE_ACCESSED_MASK;
+    } else {
+      int r = addToTLB(vab, pte);
+      assert(r == 0);
+
+      // Set the accessed bit in the page table the walk went through.
+      _countStat(accessedBitsSet, !(pte & PAGE_ACCESSED_MASK));
+      *_getPteSlot(_loadPde(pdi), vab) |= PAGE_ACCESSED_MASK;
+    }
+    return 0;
   } else {
+    _countStat(protectionFaults, 1);
     return -1; // Page Fault. Reason: Permission violation
   }
 }
 
+// Removes the translation of virtualBase in address space asid from the TLB
+// of the current CPU.
+static void _invalidatePage(uint32_t virtualBase, uint16_t asid) {
+  for (int i = 0; i < TLB_SIZE; i++) {
+    if (_tlbEntryMatches(&_cpu->tlb.entries[i], virtualBase, asid)) {
+      _cpu->tlb.entries[i].valid = 0;
+    }
+  }
+
+  // Like invlpg, this also drops the cached page directory entry, so that
+  // changes to the page directory take effect.
+  _invalidateCachedPde(_getPageDirectoryIndex(virtualBase), asid);
+}
+
 void invalidateTLBEntry(uint32_t virtualBase) {
   assert(_getOffset(virtualBase) == 0);
 
-  for (int i = 0; i < TLB_SIZE; i++) {
-    if (_tlb.entries[i].virtualBase == virtualBase) {
-      _tlb.entries[i].valid = 0;
-    }
+  _invalidatePage(virtualBase, _cpu->asid);
+}
+
+// Removes the translations of the numPages pages from virtualBase on in
+// address space asid from the TLB of the current CPU. Invalidating page by
+// page costs a TLB lookup per page, so large ranges drop the whole address
+// space instead, like a reload of CR3 does.
+static void _invalidateRange(uint32_t virtualBase, uint32_t numPages,
+                             uint16_t asid) {
+  if (numPages > TLB_FLUSH_CEILING) {
+    invalidateTLBAsid(asid);
+    return;
+  }
+
+  for (uint32_t i = 0; i < numPages; i++) {
+    _invalidatePage(virtualBase + (i << OFFSET_BITS), asid);
   }
 }
 
+void invalidateTLBRange(uint32_t virtualBase, uint32_t numPages) {
+  assert(_getOffset(virtualBase) == 0);
+
+  _invalidateRange(virtualBase, numPages, _cpu->asid);
+}
+
 static void _addToTLBAt(int index, uint32_t virtualBase, uint32_t pte) {
-  _tlb.entries[index].accessCounter = _tlb.accessCounter;
-  _tlb.entries[index].valid = 1;
-  _tlb.accessCounter++;
+  _cpu->tlb.entries[index].accessCounter = _cpu->tlb.accessCounter;
+  _cpu->tlb.entries[index].valid = 1;
+  _cpu->tlb.accessCounter++;
 
-  _tlb.entries[index].virtualBase = virtualBase;
-  _tlb.entries[index].pte = pte;
+  _cpu->tlb.entries[index].virtualBase = virtualBase;
+  _cpu->tlb.entries[index].pte = pte;
+  _cpu->tlb.entries[index].asid = _cpu->asid;
 }
 
 int addToTLB(uint32_t virtualBase, uint32_t pte) {
-  if (_getOffset(virtualBase) != 0) {
+  uint32_t offsetMask =
+      (pte & PAGE_SIZE_MASK) ? LARGE_PAGE_OFFSET_MASK : OFFSET_MASK;
+  if ((virtualBase & offsetMask) != 0) {
     return -1;
   }
 
   for (int i = 0; i < TLB_SIZE; i++) {
-    assert((!_tlb.entries[i].valid) ||
-           (virtualBase != _tlb.entries[i].virtualBase));
+    assert(!_tlbEntryMatches(&_cpu->tlb.entries[i], virtualBase, _cpu->asid));
   }
 
   int oldestEntry = 0;
   for (int i = 1; i < TLB_SIZE; i++) {
-    if (!_tlb.entries[i].valid) {
+    if (!_cpu->tlb.entries[i].valid) {
       oldestEntry = i;
       break;
     }
 
-    if (_tlb.entries[i].accessCounter <
-        _tlb.entries[oldestEntry].accessCounter) {
+    if (_cpu->tlb.entries[i].accessCounter <
+        _cpu->tlb.entries[oldestEntry].accessCounter) {
       oldestEntry = i;
     }
   }
 
+  _countStat(tlbEvictions, _cpu->tlb.entries[oldestEntry].valid);
   _addToTLBAt(oldestEntry, virtualBase, pte);
 
   return 0;
@@ -242,11 +695,165 @@ int translateTLB(uint32_t *address, ReadWrite accessMode,
 
   uint32_t vab = _getVirtualBase(*address);
   for (int i = 0; i < TLB_SIZE; i++) {
-    if (_tlb.entries[i].valid && (_tlb.entries[i].virtualBase == vab)) {
-      uint32_t pte = _tlb.entries[i].pte;
+    if (_tlbEntryMatches(&_cpu->tlb.entries[i], vab, _cpu->asid)) {
+      _countStat(tlbHits, 1);
+      uint32_t pte = _cpu->tlb.entries[i].pte;
       return _translateByEntry(address, accessMode, privileges, pte);
     }
   }
 
+  _countStat(tlbMisses, 1);
   return -1;
 }
+
+int cpuOnline(unsigned cpu) {
+  if (cpu >= MAX_CPUS) {
+    return -1;
+  }
+
+  Cpu *target = &_cpus[cpu];
+  pthread_mutex_lock(&_shootdownLock);
+  if (target->online) {
+    pthread_mutex_unlock(&_shootdownLock);
+    return -1; // Another thread runs this CPU.
+  }
+  target->online = 1;
+  pthread_mutex_unlock(&_shootdownLock);
+
+  // Invalidations sent while the CPU was offline are lost.
+  _cpu = target;
+  flushTLB();
+  return 0;
+}
+
+void cpuOffline(void) {
+  pthread_mutex_lock(&_shootdownLock);
+  _cpu->online = 0;
+  _cpu->incoming.count = 0;
+  _cpu->incoming.flushAll = 0;
+  // Release the senders still waiting for this CPU.
+  __atomic_store_n(&_cpu->handled, _cpu->requested, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&_shootdownLock);
+}
+
+// Adds range to batch, or marks the batch as a full flush if it is full.
+static void _addToBatch(ShootdownBatch *batch, ShootdownRange range) {
+  if (batch->count == SHOOTDOWN_BATCH) {
+    batch->flushAll = 1;
+  } else {
+    batch->ranges[batch->count++] = range;
+  }
+}
+
+void queueTLBShootdown(uint32_t virtualBase, uint32_t numPages) {
+  assert(_getOffset(virtualBase) == 0);
+
+  ShootdownRange range = {.virtualBase = virtualBase,
+                          .numPages = numPages,
+                          .asid = _cpu->asid};
+  _addToBatch(&_cpu->outgoing, range);
+}
+
+int flushTLBShootdowns(void) {
+  ShootdownBatch *batch = &_cpu->outgoing;
+  if ((batch->count == 0) && !batch->flushAll) {
+    return 0;
+  }
+
+  // (1) Append the batch to the invalidations of every other online CPU,
+  // which is one interrupt per CPU however many ranges the batch holds.
+  uint64_t waitFor[MAX_CPUS] = {0};
+  int sent = 0;
+  pthread_mutex_lock(&_shootdownLock);
+  for (int c = 0; c < MAX_CPUS; c++) {
+    Cpu *target = &_cpus[c];
+    if ((target == _cpu) || !target->online) {
+      continue;
+    }
+
+    target->incoming.flushAll |= batch->flushAll;
+    for (int i = 0; i < batch->count; i++) {
+      _addToBatch(&target->incoming, batch->ranges[i]);
+    }
+    waitFor[c] = __atomic_add_fetch(&target->requested, 1, __ATOMIC_RELAXED);
+    sent++;
+  }
+  pthread_mutex_unlock(&_shootdownLock);
+  batch->count = 0;
+  batch->flushAll = 0;
+
+  // (2) Wait until all of them have handled it. Meanwhile, handle the
+  // shootdowns sent to this CPU, so that two CPUs shooting at each other
+  // do not wait forever.
+  for (int c = 0; c < MAX_CPUS; c++) {
+    while ((waitFor[c] != 0) &&
+           (__atomic_load_n(&_cpus[c].handled, __ATOMIC_ACQUIRE) < waitFor[c])) {
+      handleTLBShootdowns();
+      sched_yield();
+    }
+  }
+
+  return sent;
+}
+
+void handleTLBShootdowns(void) {
+  Cpu *cpu = _cpu;
+  if (__atomic_load_n(&cpu->requested, __ATOMIC_RELAXED) ==
+      __atomic_load_n(&cpu->handled, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  pthread_mutex_lock(&_shootdownLock);
+  ShootdownBatch incoming = cpu->incoming;
+  uint64_t requested = cpu->requested;
+  cpu->incoming.count = 0;
+  cpu->incoming.flushAll = 0;
+  pthread_mutex_unlock(&_shootdownLock);
+
+  if (incoming.flushAll) {
+    flushTLB();
+  } else {
+    for (int i = 0; i < incoming.count; i++) {
+      ShootdownRange *range = &incoming.ranges[i];
+      _invalidateRange(range->virtualBase, range->numPages, range->asid);
+    }
+  }
+
+  __atomic_store_n(&cpu->handled, requested, __ATOMIC_RELEASE);
+}
+
+void enablePageTableStats(int enable) {
+  __atomic_store_n(&_statsEnabled, enable != 0, __ATOMIC_RELAXED);
+}
+
+void getPageTableStats(PageTableStats *stats) {
+  assert(stats != NULL);
+  *stats = _cpu->stats;
+}
+
+void resetPageTableStats(void) {
+  memset(&_cpu->stats, 0, sizeof(_cpu->stats));
+}
+
+void dumpPageTableStats(FILE *stream) {
+  const PageTableStats *stats = &_cpu->stats;
+  uint64_t lookups = stats->tlbHits + stats->tlbMisses;
+  double hitRate = lookups ? 100.0 * stats->tlbHits / lookups : 0.0;
+
+  fprintf(stream,
+          "TLB:        %" PRIu64 " hits, %" PRIu64 " misses (%.2f%% hit rate), "
+          "%" PRIu64 " evictions\n",
+          stats->tlbHits, stats->tlbMisses, hitRate, stats->tlbEvictions);
+  fprintf(stream,
+          "Page walks: %" PRIu64 ", %" PRIu64 " PDE cache hits, %" PRIu64
+          " accessed bits set\n",
+          stats->pageWalks, stats->pdeCacheHits, stats->accessedBitsSet);
+  fprintf(stream,
+          "Faults:     %" PRIu64 " not present, %" PRIu64 " protection\n",
+          stats->notPresentFaults, stats->protectionFaults);
+  fprintf(stream,
+          "Mapped:     %" PRIu64 " page tables, %" PRIu64 " pages, %" PRIu64
+          " large pages\n",
+          stats->pageTablesAllocated, stats->pagesMapped,
+          stats->largePagesMapped);
+}
@@ -2,9 +2,24 @@
 #define PAGE_TABLE_H
 
 #include <inttypes.h>
+#include <stdio.h>
 
 #define TLB_SIZE 4
 
+// Number of page directory entries the MMU caches to skip the first level
+// of the page walk.
+#define PDE_CACHE_SIZE 4
+
+// invalidateTLBRange() invalidates ranges of up to this many pages page by
+// page, and drops the whole address space for larger ones.
+#define TLB_FLUSH_CEILING 32
+
+// Number of simulated CPUs, each with its own TLB.
+#define MAX_CPUS 8
+
+// Number of ranges a shootdown carries before it becomes a full flush.
+#define SHOOTDOWN_BATCH 16
+
 // You can use these masks if you want to.
 #define BITS_PER_ENTRY 10
 #define ENTRIES_PER_TABLE (1 << BITS_PER_ENTRY)
@@ -14,12 +29,21 @@
 #define OFFSET_MASK ((1UL << OFFSET_BITS) - 1)
 #define BASE_MASK (~OFFSET_MASK)
 
+// A page directory entry can map a 4 MiB large page directly.
+#define LARGE_PAGE_BITS (OFFSET_BITS + BITS_PER_ENTRY)
+#define LARGE_PAGE_OFFSET_MASK ((1UL << LARGE_PAGE_BITS) - 1)
+#define LARGE_PAGE_BASE_MASK (~LARGE_PAGE_OFFSET_MASK)
+
 // The bits of the entry for the position of the page table.
 #define PAGE_DIRECTORY_ADDRESS_MASK (~((uint64_t)0xfff))
 
 // The bits of the entry for the position of the page.
 #define PAGE_TABLE_ADDRESS_MASK (~((uint32_t)0xfff))
 
+// The page size bit: the page directory entry maps a 4 MiB page instead of
+// pointing to a page table.
+#define PAGE_SIZE_MASK 0x80
+
 #define PAGE_ACCESSED_MASK 0x20
 
 // Allow usermode access
@@ -35,6 +59,22 @@ typedef enum { ACCESS_READ, ACCESS_WRITE } ReadWrite;
 
 typedef enum { USER_MODE, KERNEL_MODE } PrivilegeLevel;
 
+// Event counters of the MMU of a CPU. Mappings are counted on the CPU that
+// creates them.
+typedef struct {
+  uint64_t tlbHits;
+  uint64_t tlbMisses;
+  uint64_t tlbEvictions;     // Valid entries replaced by addToTLB().
+  uint64_t pageWalks;        // Calls of translatePageTable().
+  uint64_t pdeCacheHits;     // Walks that skipped the page directory.
+  uint64_t accessedBitsSet;  // Walks that found the accessed bit clear.
+  uint64_t notPresentFaults;
+  uint64_t protectionFaults;
+  uint64_t pageTablesAllocated;
+  uint64_t pagesMapped;      // 4 KiB pages mapped in page tables.
+  uint64_t largePagesMapped; // 4 MiB pages mapped in the page directory.
+} PageTableStats;
+
 // The 4kiB aligned page directory.
 // The size of this table is 8kiB. We use 64 bits per entry to be
 // able to test this on 64 bit systems. On 32 bit systems, 32 bits would
@@ -44,6 +84,10 @@ typedef struct {
   // Bits 12 - 63: The address of the page table.
   // Bit 0: The present bit.
   // All other bits reserved.
+  // If bit 7 (the page size bit) is set, the entry maps a 4 MiB page and
+  // looks like a page table entry instead:
+  // Bits 22 - 31: Physical base address of the target frame.
+  // Bits 6, 2, 1, 0: As in a page table entry.
   uint64_t entries[ENTRIES_PER_TABLE];
 } PageDirectory;
 
@@ -89,11 +133,39 @@ static inline uint32_t _getOffset(uint32_t address) {
   return address & OFFSET_MASK;
 }
 
+// Switches to the page directory and flushes the TLB.
 void setPageDirectory(PageDirectory *directory);
 
+// Switches to the page directory of address space asid without flushing the
+// TLB. Cached translations are tagged with the address space they belong to.
+// Use different ASIDs for different page directories.
+void setPageDirectoryAsid(PageDirectory *directory, uint16_t asid);
+
+// Removes all translations of address space asid from the TLB, e.g., before
+// the ASID is reused for another page directory.
+void invalidateTLBAsid(uint16_t asid);
+
 int mapPage(uint32_t virtualBase, uint32_t physicalBase, ReadWrite accessMode,
             PrivilegeLevel privileges);
 
+// Maps the numPages pages from virtualBase on to the consecutive frames from
+// physicalBase on. Missing page tables are taken from a pool that is
+// allocated in large blocks. Either the whole range is mapped or, on error,
+// nothing is.
+int mapRange(uint32_t virtualBase, uint32_t physicalBase, uint32_t numPages,
+             ReadWrite accessMode, PrivilegeLevel privileges);
+
+// Removes the mappings of the numPages pages from virtualBase on, and their
+// translations from the TLB of the current CPU. Other CPUs need a shootdown.
+// Fails without changes if a large page is in the range.
+int unmapRange(uint32_t virtualBase, uint32_t numPages);
+
+// Maps the 4 MiB page at virtualBase with a single page directory entry.
+// Both addresses must be 4 MiB aligned, and no page table may be mapped for
+// the range yet.
+int mapLargePage(uint32_t virtualBase, uint32_t physicalBase,
+                 ReadWrite accessMode, PrivilegeLevel privileges);
+
 int translatePageTable(uint32_t *address, ReadWrite accessMode,
                        PrivilegeLevel privileges);
 
@@ -103,7 +175,49 @@ int addToTLB(uint32_t virtualBase, uint32_t pageTableEntry);
 
 void invalidateTLBEntry(uint32_t virtualBase);
 
+// Removes the translations of the numPages pages from virtualBase on in the
+// current address space from the TLB. Ranges longer than TLB_FLUSH_CEILING
+// pages remove all translations of the address space instead.
+void invalidateTLBRange(uint32_t virtualBase, uint32_t numPages);
+
 int translateTLB(uint32_t *address, ReadWrite accessMode,
                  PrivilegeLevel privileges);
 
+// Simulated multiprocessor. Every thread runs as a CPU, CPU 0 by default,
+// with its own TLB, PDE cache and page directory. The page tables are shared,
+// so only one CPU may change them at a time.
+
+// Makes the calling thread run as CPU cpu and receive TLB shootdowns. The
+// TLB of the CPU is flushed. Returns -1 if the CPU does not exist or is
+// already online, 0 otherwise.
+int cpuOnline(unsigned cpu);
+
+// The current CPU stops receiving shootdowns.
+void cpuOffline(void);
+
+// Adds the invalidation of a range in the current address space on all
+// other CPUs to the batch of the current CPU.
+void queueTLBShootdown(uint32_t virtualBase, uint32_t numPages);
+
+// Sends the batch to all other online CPUs and waits until they have
+// handled it. Returns the number of CPUs that were interrupted.
+int flushTLBShootdowns(void);
+
+// Handles the shootdowns sent to the current CPU, like the interrupt
+// handler of a real one. Online CPUs must call this regularly.
+void handleTLBShootdowns(void);
+
+// Turns the statistics on or off for all CPUs. They are off by default,
+// which costs a predictable branch per event.
+void enablePageTableStats(int enable);
+
+// Copies the statistics of the current CPU to stats.
+void getPageTableStats(PageTableStats *stats);
+
+// Sets the statistics of the current CPU to 0.
+void resetPageTableStats(void);
+
+// Prints the statistics of the current CPU to stream.
+void dumpPageTableStats(FILE *stream);
+
 #endif
@@ -0,0 +1,177 @@
+#include "page_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Replays a trace of memory accesses through the TLB and the page table and
+ * reports the throughput. Build with:
+ *   gcc -O2 -o replay replay.c page_table.c -lpthread
+ *
+ * Usage: replay [-l] [-r repetitions] trace
+ *
+ * The trace holds one access per line: an optional R or W followed by the
+ * address, e.g. "W 0x0804a010". Empty lines and lines starting with # are
+ * skipped. All accesses are made in kernel mode. Every 4 MiB region the
+ * trace touches is identity-mapped before the replay starts, with 4 KiB
+ * pages, or with large pages if -l is given.
+ */
+
+typedef struct {
+    uint32_t address;
+    ReadWrite accessMode;
+} Access;
+
+static PageDirectory __attribute__((aligned(0x1000))) _pageDirectory;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Reads the accesses of the trace at path into *accesses. Returns the number
+ * of accesses, or -1 on error.
+ */
+static long read_trace(const char *path, Access **accesses)
+{
+    FILE *f = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    size_t count = 0, capacity = 1024;
+    *accesses = malloc(capacity * sizeof(Access));
+    char line[256];
+    long lineNumber = 0;
+    while (*accesses != NULL && fgets(line, sizeof(line), f) != NULL) {
+        lineNumber++;
+        char *p = line + strspn(line, " \t");
+        if (*p == '\n' || *p == '\0' || *p == '#') {
+            continue;
+        }
+
+        ReadWrite accessMode = ACCESS_READ;
+        if (*p == 'R' || *p == 'r' || *p == 'W' || *p == 'w') {
+            accessMode = (*p == 'W' || *p == 'w') ? ACCESS_WRITE : ACCESS_READ;
+            p++;
+        }
+        char *end;
+        unsigned long address = strtoul(p, &end, 0);
+        if (end == p || address > UINT32_MAX) {
+            fprintf(stderr, "%s:%ld: invalid address\n", path, lineNumber);
+            free(*accesses);
+            *accesses = NULL;
+            break;
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            Access *grown = realloc(*accesses, capacity * sizeof(Access));
+            if (grown == NULL) {
+                fprintf(stderr, "%s: out of memory\n", path);
+                free(*accesses);
+            }
+            *accesses = grown;
+            if (grown == NULL)
+                break;
+        }
+        (*accesses)[count].address = (uint32_t)address;
+        (*accesses)[count].accessMode = accessMode;
+        count++;
+    }
+
+    if (f != stdin)
+        fclose(f);
+    return (*accesses != NULL) ? (long)count : -1;
+}
+
+/*
+ * Identity-maps the 4 MiB regions the accesses touch. Returns the number of
+ * regions, or -1 on error.
+ */
+static int map_regions(const Access *accesses, long count, int largePages)
+{
+    static char mapped[ENTRIES_PER_TABLE];
+    int regions = 0;
+
+    for (long i = 0; i < count; i++) {
+        uint32_t pdi = _getPageDirectoryIndex(accesses[i].address);
+        if (mapped[pdi])
+            continue;
+
+        uint32_t base = pdi << LARGE_PAGE_BITS;
+        int r = largePages
+                ? mapLargePage(base, base, ACCESS_WRITE, KERNEL_MODE)
+                : mapRange(base, base, ENTRIES_PER_TABLE, ACCESS_WRITE, KERNEL_MODE);
+        if (r != 0)
+            return -1;
+        mapped[pdi] = 1;
+        regions++;
+    }
+    return regions;
+}
+
+int main(int argc, char **argv)
+{
+    int largePages = 0;
+    long repetitions = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "lr:")) != -1) {
+        switch (opt) {
+        case 'l': largePages = 1; break;
+        case 'r': repetitions = atol(optarg); break;
+        default: optind = argc + 1; break;
+        }
+    }
+    if (optind != argc - 1 || repetitions < 1) {
+        fprintf(stderr, "usage: %s [-l] [-r repetitions] trace\n", argv[0]);
+        return 2;
+    }
+
+    Access *accesses;
+    long count = read_trace(argv[optind], &accesses);
+    if (count < 0)
+        return 1;
+
+    setPageDirectory(&_pageDirectory);
+    int regions = map_regions(accesses, count, largePages);
+    if (regions < 0) {
+        fprintf(stderr, "mapping the trace failed\n");
+        return 1;
+    }
+
+    // Only the replay itself is counted.
+    enablePageTableStats(1);
+    resetPageTableStats();
+
+    long failed = 0;
+    double start = now_s();
+    for (long r = 0; r < repetitions; r++) {
+        for (long i = 0; i < count; i++) {
+            uint32_t address = accesses[i].address;
+            ReadWrite accessMode = accesses[i].accessMode;
+            if (translateTLB(&address, accessMode, KERNEL_MODE) != 0 &&
+                translatePageTable(&address, accessMode, KERNEL_MODE) != 0) {
+                failed++;
+            }
+        }
+    }
+    double elapsed = now_s() - start;
+
+    long translations = count * repetitions;
+    printf("%ld accesses x %ld, %d regions mapped with %s pages\n",
+           count, repetitions, regions, largePages ? "4 MiB" : "4 KiB");
+    printf("%.3f s, %.0f translations/s, %.1f ns per translation, %ld failed\n",
+           elapsed, translations / elapsed, elapsed * 1e9 / translations, failed);
+    dumpPageTableStats(stdout);
+
+    free(accesses);
+    return failed != 0;
+}
@@ -0,0 +1,82 @@
+#include "malloc.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Benchmark of the allocator on random alloc/free traces. Build with:
+ *   gcc -O2 -o bench bench.c malloc.c
+ */
+
+/*
+ * Number of allocations that are live at the same time, and the number of
+ * operations of every trace. Each operation frees a random slot, if it is
+ * in use, and fills it with a new allocation.
+ */
+#define SLOTS 4096
+#define OPERATIONS 1000000
+
+typedef enum { SIZES_SMALL, SIZES_MIXED } SizeMix;
+
+static void *_slots[SLOTS];
+static uint64_t _rngState;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(void)
+{
+    _rngState ^= _rngState << 13;
+    _rngState ^= _rngState >> 7;
+    _rngState ^= _rngState << 17;
+    return _rngState;
+}
+
+/*
+ * Returns a random request size. Small sizes are up to 256 bytes. The mixed
+ * sizes are 80% small ones, 15% up to 4 KiB and 5% up to 64 KiB.
+ */
+static uint64_t random_size(SizeMix mix)
+{
+    uint64_t r = next_random();
+    unsigned percent = r % 100;
+    r /= 100;
+    if (mix == SIZES_SMALL || percent < 80)
+        return 1 + r % 256;
+    if (percent < 95)
+        return 1 + r % 4096;
+    return 1 + r % 65536;
+}
+
+static void bench_trace(const char *name, SizeMix mix)
+{
+    initAllocator();
+    for (int i = 0; i < SLOTS; i++)
+        _slots[i] = NULL;
+    _rngState = 88172645463325252ULL;
+
+    long failed = 0;
+    double start = now_s();
+    for (int i = 0; i < OPERATIONS; i++) {
+        unsigned slot = next_random() % SLOTS;
+        my_free(_slots[slot]);
+        _slots[slot] = my_malloc(random_size(mix));
+        failed += _slots[slot] == NULL;
+    }
+    double elapsed = now_s() - start;
+
+    printf("  %-6s %8.1f ns per free and malloc, %6ld failed allocations\n",
+           name, elapsed * 1e9 / OPERATIONS, failed);
+}
+
+int main()
+{
+    printf("%d operations on %d slots\n", OPERATIONS, SLOTS);
+    bench_trace("small", SIZES_SMALL);
+    bench_trace("mixed", SIZES_MIXED);
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include "malloc.h"
 #include "testlib.h"
 
+#include <stddef.h>
+
 int main() {
   test_start("malloc.c");
   initAllocator();
@@ -25,5 +27,37 @@ int main() {
   my_malloc(1);
   dumpAllocator();
 
+  // A freed small block is reused for the next request of its size class.
+  initAllocator();
+  void *small = my_malloc(100);
+  my_malloc(100);
+  my_free(small);
+  test_equals_ptr(my_malloc(97), small, "a freed block is reused for its size class");
+
+  // Large requests take the best fit of their bin.
+  initAllocator();
+  void *loose = my_malloc(3000);
+  my_malloc(16);
+  void *tight = my_malloc(2100);
+  my_malloc(16);
+  my_free(loose);
+  my_free(tight);
+  test_equals_ptr(my_malloc(2000), tight, "a large request takes the best fit");
+
+  // Freed neighbors are merged once the heap runs out.
+  initAllocator();
+  void *blocks[1100];
+  int count = 0;
+  while ((blocks[count] = my_malloc(16000)) != NULL) {
+    count++;
+  }
+  test_assert(count > 1000, "the heap holds more than 1000 blocks of 16000 bytes");
+  for (int i = 0; i < count; i++) {
+    my_free(blocks[i]);
+  }
+  test_assert(my_malloc(16 * 1024 * 1024 - 16) != NULL, "freed blocks are merged into the whole heap");
+  test_equals_ptr(my_malloc(1), NULL, "the heap is exhausted");
+  test_equals_ptr(my_malloc(UINT64_MAX), NULL, "requests larger than the heap fail");
+
   return test_end();
 }
@@ -2,12 +2,13 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 typedef struct _Block {
   /*
-   * Pointer to the header of the next free block.
+   * Pointer to the header of the next free block in the same bin.
    * Only valid if this block is also free.
-   * This is null for the last Block of the free list.
+   * This is null for the last Block of a free list.
    */
   struct _Block *next;
 
@@ -19,7 +20,7 @@ typedef struct _Block {
 
   /*
    * The size of this block, including the header
-   * Always a multiple of 16 bytes.
+   * Always a multiple of 16 bytes. The lowest bit is PREV_FREE_FLAG.
    */
   uint64_t size;
 
@@ -33,25 +34,81 @@ typedef struct _Block {
 #define INV_HEADER_SIZE_MASK ~((uint64_t)HEADER_SIZE - 1)
 #define ALLOCATED_BLOCK_MAGIC (Block *)(0xbaadf00d)
 
+/*
+ * Set in the size of a block if the block before it is free.
+ */
+#define PREV_FREE_FLAG ((uint64_t)1)
+
+/*
+ * A free block keeps the link that points to it in the first bytes of its
+ * data area, so that it can be removed from its free list, and a copy of its
+ * size in the last bytes, so that the block after it can find it. Blocks are
+ * thus never smaller than two headers.
+ */
+#define MIN_BLOCK_SIZE (2 * HEADER_SIZE)
+
 /*
  * This is the heap you should use.
  * 16 MiB heap space per default. The heap does not grow.
  */
 #define HEAP_SIZE (HEADER_SIZE * 1024 * 1024)
+#define HEAP_SIZE_BITS 24
 uint8_t __attribute__((aligned(HEADER_SIZE))) _heapData[HEAP_SIZE];
 
 /*
- * This should point to the first free block in memory.
+ * Free blocks are kept in segregated free lists (bins) by size. Blocks of up
+ * to SMALL_BLOCK_LIMIT bytes have a bin for every multiple of 16 bytes, so
+ * that any block of the bin fits a request of that size. Larger blocks are
+ * kept in a bin per power of two, which is searched for the best fit.
  */
-Block *_firstFreeBlock;
+#define SMALL_BLOCK_LIMIT 1024
+#define SMALL_BLOCK_LIMIT_BITS 10
+#define NUM_SMALL_BINS ((SMALL_BLOCK_LIMIT - MIN_BLOCK_SIZE) / HEADER_SIZE + 1)
+#define NUM_BINS (NUM_SMALL_BINS + HEAP_SIZE_BITS - SMALL_BLOCK_LIMIT_BITS + 1)
+#define BIN_MAP_WORDS ((NUM_BINS + 63) / 64)
 
 /*
- * Initialize the memory block. You don't need to change this.
+ * The first free block of every bin, and a bit for every bin that is not
+ * empty.
  */
-void initAllocator() {
-  _firstFreeBlock = (Block *)&_heapData[0];
-  _firstFreeBlock->next = NULL;
-  _firstFreeBlock->size = HEAP_SIZE;
+static Block *_bins[NUM_BINS];
+static uint64_t _binMap[BIN_MAP_WORDS];
+
+/*
+ * Returns the size of the block without the flags.
+ */
+static uint64_t _getSize(const Block *block) {
+  return block->size & INV_HEADER_SIZE_MASK;
+}
+
+/*
+ * Returns the bin for free blocks of the given size.
+ */
+static unsigned _getBinIndex(uint64_t size) {
+  assert(size >= MIN_BLOCK_SIZE);
+
+  if (size <= SMALL_BLOCK_LIMIT) {
+    return (size - MIN_BLOCK_SIZE) / HEADER_SIZE;
+  }
+
+  unsigned log2 = 63 - __builtin_clzll(size);
+  assert(log2 >= SMALL_BLOCK_LIMIT_BITS && log2 <= HEAP_SIZE_BITS);
+  return NUM_SMALL_BINS + log2 - SMALL_BLOCK_LIMIT_BITS;
+}
+
+/*
+ * Returns the location of the link that points to the free block.
+ */
+static Block ***_getPrevLink(Block *freeBlock) {
+  return (Block ***)&freeBlock->data[0];
+}
+
+/*
+ * Returns the location of the copy of the free block's size.
+ */
+static uint64_t *_getFooter(Block *freeBlock) {
+  return (uint64_t *)&freeBlock->data[_getSize(freeBlock) - HEADER_SIZE -
+                                      sizeof(uint64_t)];
 }
 
 /*
@@ -59,14 +116,100 @@ void initAllocator() {
  */
 static Block *_getNextBlockBySize(const Block *current) {
   static const Block *end = (Block *)&_heapData[HEAP_SIZE];
-  Block *next = (Block *)&current->data[current->size - HEADER_SIZE];
+  Block *next = (Block *)&current->data[_getSize(current) - HEADER_SIZE];
 
   assert(next <= end);
   return (next == end) ? NULL : next;
 }
 
 /*
- * Dumps the allocator. You should not need to modify this.
+ * Adds the block to the front of the free list of its bin and tells the
+ * block after it that it is free.
+ */
+static void _pushFreeBlock(Block *block) {
+  unsigned bin = _getBinIndex(_getSize(block));
+
+  block->next = _bins[bin];
+  if (block->next != NULL) {
+    *_getPrevLink(block->next) = &block->next;
+  }
+  *_getPrevLink(block) = &_bins[bin];
+  _bins[bin] = block;
+  _binMap[bin / 64] |= 1ULL << (bin % 64);
+
+  *_getFooter(block) = _getSize(block);
+  Block *next = _getNextBlockBySize(block);
+  if (next != NULL) {
+    next->size |= PREV_FREE_FLAG;
+  }
+}
+
+/*
+ * Removes the free block from the free list of its bin.
+ */
+static void _removeFreeBlock(Block *block) {
+  Block **prevLink = *_getPrevLink(block);
+  *prevLink = block->next;
+  if (block->next != NULL) {
+    *_getPrevLink(block->next) = prevLink;
+  }
+
+  unsigned bin = _getBinIndex(_getSize(block));
+  if (_bins[bin] == NULL) {
+    _binMap[bin / 64] &= ~(1ULL << (bin % 64));
+  }
+}
+
+/*
+ * Initialize the memory block.
+ */
+void initAllocator() {
+  memset(_bins, 0, sizeof(_bins));
+  memset(_binMap, 0, sizeof(_binMap));
+
+  Block *block = (Block *)&_heapData[0];
+  block->size = HEAP_SIZE;
+  _pushFreeBlock(block);
+}
+
+/*
+ * Returns the first bin from the given one on that is not empty, or -1.
+ */
+static int _findNonEmptyBin(unsigned bin) {
+  for (unsigned word = bin / 64; word < BIN_MAP_WORDS; word++) {
+    uint64_t bits = _binMap[word];
+    if (word == bin / 64) {
+      bits &= ~0ULL << (bin % 64);
+    }
+    if (bits != 0) {
+      return word * 64 + __builtin_ctzll(bits);
+    }
+  }
+  return -1;
+}
+
+/*
+ * Returns the smallest block in the bin that offers at least size bytes, or
+ * NULL.
+ */
+static Block *_findBestFit(unsigned bin, uint64_t size) {
+  Block *best = NULL;
+
+  for (Block *current = _bins[bin]; current != NULL; current = current->next) {
+    uint64_t currentSize = _getSize(current);
+    if (currentSize == size) {
+      return current;
+    }
+    if ((currentSize > size) &&
+        ((best == NULL) || (currentSize < _getSize(best)))) {
+      best = current;
+    }
+  }
+  return best;
+}
+
+/*
+ * Dumps the allocator.
  */
 void dumpAllocator() {
   Block *current;
@@ -74,27 +217,30 @@ void dumpAllocator() {
   printf("All blocks:\n");
   current = (Block *)&_heapData[0];
   while (current) {
-    assert((current->size & INV_HEADER_SIZE_MASK) == current->size);
-    assert(current->size > 0);
+    assert(_getSize(current) >= MIN_BLOCK_SIZE);
 
     printf("  Block starting at %" PRIuPTR ", size %" PRIu64 " (%s)\n",
            ((uintptr_t)(void *)current - (uintptr_t)(void *)&_heapData[0]),
-           current->size,
+           _getSize(current),
            (current->next == ALLOCATED_BLOCK_MAGIC) ? "allocated" : "free");
 
     current = _getNextBlockBySize(current);
   }
 
-  printf("Current free block list:\n");
-  current = _firstFreeBlock;
-  while (current) {
-    assert(current->next != ALLOCATED_BLOCK_MAGIC);
+  printf("Current free block lists:\n");
+  for (unsigned bin = 0; bin < NUM_BINS; bin++) {
+    current = _bins[bin];
+    while (current) {
+      assert(current->next != ALLOCATED_BLOCK_MAGIC);
+      assert(_getBinIndex(_getSize(current)) == bin);
 
-    printf("  Free block starting at %" PRIuPTR ", size %" PRIu64 "\n",
-           ((uintptr_t)(void *)current - (uintptr_t)(void *)&_heapData[0]),
-           current->size);
+      printf("  Free block starting at %" PRIuPTR ", size %" PRIu64
+             " (bin %u)\n",
+             ((uintptr_t)(void *)current - (uintptr_t)(void *)&_heapData[0]),
+             _getSize(current), bin);
 
-    current = current->next;
+      current = current->next;
+    }
   }
 }
 
@@ -105,32 +251,36 @@ uint64_t roundUp(uint64_t n) {
   return (n + HEADER_SIZE - 1) & INV_HEADER_SIZE_MASK;
 }
 
-static void *_allocate(Block **blockLink, uint64_t size) {
-  assert(blockLink != NULL);
+static void *_allocate(Block *freeBlock, uint64_t size) {
+  assert(freeBlock != NULL);
   assert((size & INV_HEADER_SIZE_MASK) == size);
-  assert(size >= HEADER_SIZE);
+  assert(size >= MIN_BLOCK_SIZE);
+  assert(_getSize(freeBlock) >= size);
 
-  Block *freeBlock = *blockLink;
-  assert(freeBlock != NULL);
-  assert(freeBlock->size >= size);
+  _removeFreeBlock(freeBlock);
+
+  // Free blocks are always merged, so the block before this one is in use.
+  assert(!(freeBlock->size & PREV_FREE_FLAG));
 
-  if (freeBlock->size == size) {
-    // The selected free block exactly fits the requested size. We thus
-    // do not need to split the block.
-    *blockLink = freeBlock->next;
+  const uint64_t remainingSize = _getSize(freeBlock) - size;
+  if (remainingSize < MIN_BLOCK_SIZE) {
+    // The selected free block fits the requested size, or the rest would be
+    // too small for a free block. We thus do not split the block.
+    Block *next = _getNextBlockBySize(freeBlock);
+    if (next != NULL) {
+      next->size &= ~PREV_FREE_FLAG;
+    }
   } else {
     // The free block is larger. We thus split it into two blocks. One
-    // allocated that we return to the caller and a new free one.
-    const uint64_t remainingSize = freeBlock->size - size;
+    // allocated that we return to the caller and a new free one, which goes
+    // to the bin of its size.
     assert((remainingSize & INV_HEADER_SIZE_MASK) == remainingSize);
-    assert(remainingSize >= HEADER_SIZE);
 
     freeBlock->size = size;
 
     Block *newFreeBlock = _getNextBlockBySize(freeBlock);
     newFreeBlock->size = remainingSize;
-    newFreeBlock->next = freeBlock->next;
-    *blockLink = newFreeBlock;
+    _pushFreeBlock(newFreeBlock);
   }
 
   // Mark the current block as allocated by setting a magic next value
@@ -139,53 +289,53 @@ static void *_allocate(Block **blockLink, uint64_t size) {
   return &freeBlock->data[0];
 }
 
-void *my_malloc(uint64_t size) {
-  // Calculate the minimum size of the free block we need to find.
-  // We only allocate blocks that are multiples of 16 bytes in size, so we
-  // round up the requested size. This potentially wastes some memory but
-  // makes management easier. We also need to store our block header.
-  const uint64_t requestedSize = roundUp(size) + HEADER_SIZE;
-  Block *current = _firstFreeBlock;
-  Block **link = &_firstFreeBlock;
-
-  while (current) {
-    if (current->size >= requestedSize) {
-      return _allocate(link, requestedSize);
+/*
+ * Returns a free block of at least size bytes, or NULL if there is none.
+ */
+static Block *_findFreeBlock(uint64_t size) {
+  unsigned bin = _getBinIndex(size);
+
+  // (1) Small blocks of the requested size are all in one bin. Large ones
+  // share it with smaller blocks.
+  if (bin < NUM_SMALL_BINS) {
+    if (_bins[bin] != NULL) {
+      return _bins[bin];
+    }
+  } else {
+    Block *block = _findBestFit(bin, size);
+    if (block != NULL) {
+      return block;
     }
+  }
 
-    // We did not find a large-enough block, yet. Move on to the next one.
-    link = &current->next;
-    current = current->next;
+  // (2) All blocks in the bins behind are large enough.
+  int next = _findNonEmptyBin(bin + 1);
+  if (next < 0) {
+    return NULL;
   }
 
-  // We did not find a free block that offers enough space. Return NULL to
-  // indicate that the allocation failed.
-  return NULL;
+  bin = next;
+  return (bin < NUM_SMALL_BINS) ? _bins[bin] : _findBestFit(bin, size);
 }
 
-/*
- * Check if we can merge this block with the next one.
- */
-static void _tryMerge(Block *freeBlock) {
-  assert(freeBlock != NULL);
-  assert(freeBlock->next != ALLOCATED_BLOCK_MAGIC);
-
-  // If there is no free block after the given one, there
-  // is nothing we can merge.
-  if (freeBlock->next == NULL) {
-    return;
+void *my_malloc(uint64_t size) {
+  if (size > HEAP_SIZE) {
+    return NULL;
   }
 
-  // Look at the next block in the heap. If it is linked with the free block
-  // it is also free and we can merge the blocks.
-  const Block *next = _getNextBlockBySize(freeBlock);
-
-  if (next == freeBlock->next) {
-    assert(next->next != ALLOCATED_BLOCK_MAGIC);
-
-    freeBlock->size += next->size;
-    freeBlock->next = next->next;
+  // Calculate the minimum size of the free block we need to find.
+  // We only allocate blocks that are multiples of 16 bytes in size, so we
+  // round up the requested size. This potentially wastes some memory but
+  // makes management easier. We also need to store our block header.
+  uint64_t requestedSize = roundUp(size) + HEADER_SIZE;
+  if (requestedSize < MIN_BLOCK_SIZE) {
+    requestedSize = MIN_BLOCK_SIZE;
   }
+
+  // If we do not find a free block that offers enough space, return NULL to
+  // indicate that the allocation failed.
+  Block *freeBlock = _findFreeBlock(requestedSize);
+  return (freeBlock != NULL) ? _allocate(freeBlock, requestedSize) : NULL;
 }
 
 void my_free(void *address) {
@@ -202,28 +352,27 @@ void my_free(void *address) {
   Block *block = (Block *)(address)-1;
   assert(block->next == ALLOCATED_BLOCK_MAGIC);
 
-  Block *freeBlock = _firstFreeBlock;
-
-  // The free block must be inserted at the correct position in the free list
-  // to allow merging with the neighbor blocks in the case they are free, too
-  // We can find the correct position easily, by comparing the block addresses
-  if ((freeBlock == NULL) || (freeBlock > block)) {
-    // Insert the block at the front of the freelist
-    _firstFreeBlock = block;
-    block->next = freeBlock;
+  // Merge the block with its neighbors in the case they are free, too. The
+  // merged block goes to the bin of its new size.
+  uint64_t size = _getSize(block);
 
-    _tryMerge(block);
-  } else {
-    // Iterate the free list until we reach its end or find the correct pos
-    while ((freeBlock->next != NULL) && (freeBlock->next < block)) {
-      freeBlock = freeBlock->next;
-    }
+  Block *next = _getNextBlockBySize(block);
+  if ((next != NULL) && (next->next != ALLOCATED_BLOCK_MAGIC)) {
+    _removeFreeBlock(next);
+    size += _getSize(next);
+  }
 
-    // Insert block into free list and try to merge with neighbor blocks
-    block->next = freeBlock->next;
-    freeBlock->next = block;
+  if (block->size & PREV_FREE_FLAG) {
+    const uint64_t prevSize = *((uint64_t *)block - 1);
+    Block *prev = (Block *)((uint8_t *)block - prevSize);
+    assert(prev->next != ALLOCATED_BLOCK_MAGIC);
+    assert(_getSize(prev) == prevSize);
 
-    _tryMerge(block);
-    _tryMerge(freeBlock);
+    _removeFreeBlock(prev);
+    size += prevSize;
+    block = prev;
   }
+
+  block->size = size;
+  _pushFreeBlock(block);
 }
@@ -67,6 +67,7 @@ int main()
     test_start("page_faults.c");
 
     setPageDirectory(&basePageDirectory);
+    enablePageTableStats(1);
 
     // Access some nulled pages.
     // They should be mapped to the fake addresses.
@@ -112,5 +113,14 @@ int main()
     printf("Your page table after re-accessing some pages:\n");
     _dumpPageDirectory(&basePageDirectory);
 
+    PageTableStats stats;
+    getPageTableStats(&stats);
+    printf("\n");
+    dumpPageTableStats(stdout);
+    test_equals_int64(stats.pageWalks, 17, "Every access walked the page table");
+    test_equals_int64(stats.notPresentFaults, 11, "Accesses to nulled, file and swapped pages faulted");
+    test_equals_int64(stats.swappedFaults, 3, "Accesses to swapped pages faulted");
+    test_equals_int64(stats.protectionFaults, 3, "Accesses without permission faulted");
+
     return test_end();
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define PAGE_FAULTS_H
 
 #include <inttypes.h>
+#include <stdio.h>
 
 #ifndef ALLOW_OVERRIDE
 #define ALLOW_OVERRIDE __attribute__((weak))
@@ -42,6 +43,20 @@ typedef enum { ACCESS_READ, ACCESS_WRITE } ReadWrite;
 
 typedef enum { USER_MODE, KERNEL_MODE } PrivilegeLevel;
 
+// Event counters of the MMU.
+typedef struct {
+  uint64_t tlbHits;
+  uint64_t tlbMisses;
+  uint64_t tlbEvictions;    // Valid entries replaced by addToTLB().
+  uint64_t pageWalks;       // Calls of translatePageTable().
+  uint64_t accessedBitsSet; // Walks that found the accessed bit clear.
+  uint64_t notPresentFaults;
+  uint64_t swappedFaults;   // Not present faults on swapped out pages.
+  uint64_t protectionFaults;
+  uint64_t pageTablesAllocated;
+  uint64_t pagesMapped;
+} PageTableStats;
+
 // The first-level page table - the page directory.
 // The table must be 4KiB aligned. The size of this table is 8KiB. We use 64
 // bits per entry to be able to test this on 64 bit systems. On 32 bit systems,
@@ -116,6 +131,13 @@ void invalidateTLBEntry(uint32_t virtualBase);
 
 int handlePageFault(uint32_t virtualBase, uint32_t pte);
 
+// Turns the statistics on or off. They are off by default, which costs a
+// predictable branch per event.
+void enablePageTableStats(int enable);
+void getPageTableStats(PageTableStats *stats);
+void resetPageTableStats(void);
+void dumpPageTableStats(FILE *stream);
+
 int swapOut(uint32_t virtualBase);
 
 /* Helper functions from page_table.c */
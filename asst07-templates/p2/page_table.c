@@ -24,6 +24,18 @@ typedef struct {
 // This is reset to all 0.
 static TLB _tlb;
 
+// Only updated while _statsEnabled is set.
+static PageTableStats _stats;
+static int _statsEnabled = 0;
+
+// Adds count to the statistics counter field if the statistics are enabled.
+#define _countStat(field, count)                                               \
+  do {                                                                         \
+    if (__builtin_expect(_statsEnabled, 0)) {                                  \
+      _stats.field += (count);                                                 \
+    }                                                                          \
+  } while (0)
+
 void setPageDirectory(PageDirectory *directory) {
   _cr3 = directory;
   flushTLB();
@@ -59,6 +71,7 @@ int _setPte(uint32_t virtualBase, uint32_t pte) {
 
     pde = address | PAGE_PRESENT_MASK;
     _cr3->entries[pdi] = pde;
+    _countStat(pageTablesAllocated, 1);
   } else {
     uint64_t pageTableAddress = pde & PAGE_DIRECTORY_ADDRESS_MASK;
     pageTable = (PageTable *)intToPointer(pageTableAddress);
@@ -119,6 +132,7 @@ int mapPage(uint32_t virtualBase, uint32_t physicalBase, ReadWrite accessMode,
   // Set the new PTE and invalidate any cached version in the TLB
   int res = _setPte(virtualBase, pte);
   invalidateTLBEntry(virtualBase);
+  _countStat(pagesMapped, res == 0);
 
   return res;
 }
@@ -163,9 +177,12 @@ int translatePageTable(uint32_t *address, ReadWrite accessMode,
 
   uint32_t vab = _getVirtualBase(*address);
   uint32_t pte = _getPte(vab);
+  _countStat(pageWalks, 1);
 
   if (!(pte & PAGE_PRESENT_MASK)) {
     // Page Fault. Reason: Not present
+    _countStat(notPresentFaults, 1);
+    _countStat(swappedFaults, (pte & PAGE_SWAPPED_MASK) != 0);
     if (handlePageFault(vab, pte) <= 0) {
       return -1;
     }
@@ -180,9 +197,11 @@ int translatePageTable(uint32_t *address, ReadWrite accessMode,
     int r = addToTLB(vab, pte);
     assert(r == 0);
 
+    _countStat(accessedBitsSet, !(pte & PAGE_ACCESSED_MASK));
     pte |= PAGE_ACCESSED_MASK;
     return _setPte(vab, pte);
   } else {
+    _countStat(protectionFaults, 1);
     return -1; // Page Fault. Reason: Permission violation
   }
 }
@@ -229,6 +248,7 @@ int addToTLB(uint32_t virtualBase, uint32_t pte) {
     }
   }
 
+  _countStat(tlbEvictions, _tlb.entries[oldestEntry].valid);
   _addToTLBAt(oldestEntry, virtualBase, pte);
 
   return 0;
@@ -243,10 +263,40 @@ int translateTLB(uint32_t *address, ReadWrite accessMode,
   uint32_t vab = _getVirtualBase(*address);
   for (int i = 0; i < TLB_SIZE; i++) {
     if (_tlb.entries[i].valid && (_tlb.entries[i].virtualBase == vab)) {
+      _countStat(tlbHits, 1);
       uint32_t pte = _tlb.entries[i].pte;
       return _translateByEntry(address, accessMode, privileges, pte);
     }
   }
 
+  _countStat(tlbMisses, 1);
   return -1;
 }
+
+void enablePageTableStats(int enable) { _statsEnabled = (enable != 0); }
+
+void getPageTableStats(PageTableStats *stats) {
+  assert(stats != NULL);
+  *stats = _stats;
+}
+
+void resetPageTableStats(void) { memset(&_stats, 0, sizeof(_stats)); }
+
+void dumpPageTableStats(FILE *stream) {
+  uint64_t lookups = _stats.tlbHits + _stats.tlbMisses;
+  double hitRate = lookups ? 100.0 * _stats.tlbHits / lookups : 0.0;
+
+  fprintf(stream,
+          "TLB:        %" PRIu64 " hits, %" PRIu64 " misses (%.2f%% hit rate), "
+          "%" PRIu64 " evictions\n",
+          _stats.tlbHits, _stats.tlbMisses, hitRate, _stats.tlbEvictions);
+  fprintf(stream, "Page walks: %" PRIu64 ", %" PRIu64 " accessed bits set\n",
+          _stats.pageWalks, _stats.accessedBitsSet);
+  fprintf(stream,
+          "Faults:     %" PRIu64 " not present (%" PRIu64 " swapped), %" PRIu64
+          " protection\n",
+          _stats.notPresentFaults, _stats.swappedFaults,
+          _stats.protectionFaults);
+  fprintf(stream, "Mapped:     %" PRIu64 " page tables, %" PRIu64 " pages\n",
+          _stats.pageTablesAllocated, _stats.pagesMapped);
+}
@@ -0,0 +1,58 @@
+#ifndef CONTEXT_SWITCH_H
+#define CONTEXT_SWITCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Entry function of a new context. transfer is the value passed to the
+ * switch that started the context, arg the value given to initContext().
+ * The function must never return.
+ */
+typedef void (*ContextEntry)(void *transfer, void *arg);
+
+/*
+ * Saves the current context, stores its stack pointer to *saveSp and resumes
+ * the context at newSp. Returns the transfer value of the switch that resumes
+ * the current context again.
+ */
+void *switchContext(void **saveSp, void *newSp, void *transfer);
+
+/*
+ * Same as switchContext(), but also preserves the x87 control word and MXCSR.
+ * A context saved by switchContext() is resumed with the default values.
+ */
+void *switchContextFpu(void **saveSp, void *newSp, void *transfer);
+
+void contextTrampoline(void);
+
+/*
+ * Default x87 control word and MXCSR as set up by the System V ABI.
+ */
+#define CONTEXT_DEFAULT_FCW 0x037F
+#define CONTEXT_DEFAULT_MXCSR 0x1F80
+
+/*
+ * Prepares a new context on the stack that ends at stackTop, so that the
+ * first switch to it calls entry(transfer, arg).
+ * Returns the stack pointer to pass to switchContext().
+ */
+static inline void *initContext(void *stackTop, ContextEntry entry, void *arg)
+{
+    // Align the top so that entry is called with a correctly aligned stack.
+    uintptr_t top = (uintptr_t)stackTop & ~(uintptr_t)15;
+    void **sp = (void **)top;
+
+    *--sp = (void *)contextTrampoline; // return address of the switch
+    *--sp = NULL;                      // rbp
+    *--sp = (void *)entry;             // rbx
+    *--sp = arg;                       // r12
+    *--sp = NULL;                      // r13
+    *--sp = NULL;                      // r14
+    *--sp = NULL;                      // r15
+    *--sp = (void *)(((uintptr_t)CONTEXT_DEFAULT_MXCSR << 32) |
+                     CONTEXT_DEFAULT_FCW);
+    return sp;
+}
+
+#endif
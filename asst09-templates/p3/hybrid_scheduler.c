@@ -1,4 +1,5 @@
 #include "hybrid_scheduler.h"
+#include "context_switch.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -8,6 +9,17 @@
 #define EBR_DEBUG 0
 #define SCHED_DEBUG 0
 
+/*
+ * Set to 1 to preserve the x87 control word and MXCSR across context switches.
+ */
+#define SCHED_SAVE_FPU 0
+
+#if SCHED_SAVE_FPU
+#define _switchContext switchContextFpu
+#else
+#define _switchContext switchContext
+#endif
+
 /*
  * Currently-active KLT
  */
@@ -455,6 +467,33 @@ Thread *scheduleNextThread()
     return _dequeueThread(HIGHEST_PRIORITY);
 }
 
+/*
+ * Handed from the thread that switches away to the thread that runs next,
+ * which enqueues the previous thread once it is off its stack.
+ */
+typedef struct _SwitchInfo
+{
+    Thread *prevThread;
+    Queue *queue;
+} SwitchInfo;
+
+/*
+ * Runs on the new thread's stack right after every switch.
+ */
+static void _finishSwitch(SwitchInfo *info)
+{
+    // The info lives on the previous thread's stack. Read it before the
+    // thread becomes visible to other KLTs.
+    Thread *prevThread = info->prevThread;
+    Queue *queue = info->queue;
+
+    if (prevThread->state == STATE_RUNNING)
+    {
+        prevThread->state = STATE_READY;
+    }
+    enqueue(queue, prevThread);
+}
+
 /*
  * Select and switch to another thread, and then enqueue the current thread to the given queue.
  */
@@ -491,38 +530,11 @@ void contextSwitch(Queue *queue)
     _current_thread->state = STATE_RUNNING;
     assert(_current_thread->currentSP != NULL);
 
-    // Do the context switch
-    __asm__ __volatile__(
-        "movq  %[prevTh], %%rax\n\t" // save prevThread from old stack
-        "movq  %[queue], %%rcx\n\t"  // save queue from old stack
-        "pushq %%rbp\n\t"            // Push registers to old stack
-        "pushq %%rbx\n\t"
-        "pushq %%r12\n\t"
-        "pushq %%r13\n\t"
-        "pushq %%r14\n\t"
-        "pushq %%r15\n\t"
-
-        "movq  %%rsp, %[prevSp]\n\t" // Store current stack pointer
-        "movq  %[newSp], %%rsp\n\t"  // Switch to the new stack
-
-        "popq  %%r15\n\t" // Pop registers from new stack
-        "popq  %%r14\n\t"
-        "popq  %%r13\n\t"
-        "popq  %%r12\n\t"
-        "popq  %%rbx\n\t"
-        "popq  %%rbp\n\t"
-        "movq  %%rax, %[prevTh]\n\t" // restore prevThread to new stack
-        "movq  %%rcx, %[queue]\n\t"  // restore queue to new stack
-
-        : /* output */[prevSp] "=m"(prevThread->currentSP), [prevTh] "+m"(prevThread), [queue] "+m"(queue)
-        : /* input */[newSp] "m"(_current_thread->currentSP)
-        : /* clobber */ "rax", "rcx", "cc", "memory");
-
-    if (prevThread->state == STATE_RUNNING)
-    {
-        prevThread->state = STATE_READY;
-    }
-    enqueue(queue, prevThread);
+    // Do the context switch. The thread we switch to finishes it by enqueuing
+    // prevThread, either here or in _threadStart() if it is new.
+    SwitchInfo info = {prevThread, queue};
+    SwitchInfo *from = _switchContext(&prevThread->currentSP, _current_thread->currentSP, &info);
+    _finishSwitch(from);
 }
 
 /*
@@ -541,6 +553,19 @@ static void _threadFinished()
     assert(!"contextSwitch should never return here");
 }
 
+/*
+ * Entry point of every new thread. The first switch to a thread lands here
+ * instead of in contextSwitch().
+ */
+static void _threadStart(void *transfer, void *arg)
+{
+    void (*func)(void) = (void (*)(void))arg;
+
+    _finishSwitch(transfer);
+    func();
+    _threadFinished();
+}
+
 /*
  * Prepares a new thread.
  * Returns the thread id or -1 on error.
@@ -562,38 +587,10 @@ int startThread(void (*func)(void), int priority)
     // Stacks grow from high addresses to low addresses. The stack thus
     // effectively starts at the end of the allocated memory area and
     // grows to the area's beginning.
-    // We here assume the stack to be an array of void*'s, that is
-    // pointers. A pointer has the right size (e.g., 32 or 64 bits) to
-    // hold a full CPU register and can receive function pointers
-    // without casting. stackTop is thus a pointer to pointers.
-    void **stackTop = (void **)(thread->stack + STACK_SIZE);
-
-    // We need to write the values to the stack in the reverse order
-    // they will be needed when yield() switches to this stack.
-
-    // 'Push' the address that func() will pop from the stack and jump
-    // to when it returns. We will use parkThread here.
-    stackTop--;
-    *stackTop = _threadFinished;
-
-    // The stack that is switched to on a yield().
-    // The return of yield() will pop this address off the stack
-    // and then jump to it. This way, the user function gets invoked.
-    stackTop--;
-    *stackTop = func;
-
-    // Leave will pop this base pointer from the stack, when returning
-    // from yield().
-    stackTop--;
-    *stackTop = stackTop;
-
-    // Although we pop 6 registers after yield switches to this
-    // stack, we only need to reserve space for 5 more, because we use
-    // the position for the stack base pointer (ebp) twice (see
-    // Understanding Solution PDF). We do not need to care about the
-    // values because yield() switches to the thread for the first time
-    // and there are thus no special values to restore.
-    stackTop -= 5;
+    // initContext() places a frame at the top of the stack that looks like a
+    // suspended switch, so that the first switch to the thread calls
+    // _threadStart(), which runs func and then finishes the thread.
+    void *stackTop = initContext(thread->stack + STACK_SIZE, _threadStart, (void *)func);
 
     // We initialized the stack and the thread is ready to run.
     // After setting STATE_READY, the thread is eligible to dispatching